@@ -0,0 +1,360 @@
+/** @file admin.c
+ *  @brief Function definitions for the admin library.
+ *
+ * The admin library is developed to let the admin
+ * process hand messages to the nodes without ever
+ * blocking on a node that is falling behind.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "admin.h"
+
+// Attempts a single write, returns ADMIN_SEND_OK, ADMIN_SEND_DEFERRED or ADMIN_SEND_REJECTED
+static int admin_channel_write(admin_channel *ch, message *msg) {
+  ssize_t wr_len;
+
+  if(ch->fd < 0) {
+    return ADMIN_SEND_REJECTED;
+  }
+
+  do {
+    wr_len = write(ch->fd, msg, sizeof(message));
+  } while(wr_len < 0 && errno == EINTR);
+
+  if(wr_len == sizeof(message)) {
+    ch->sent++;
+    return ADMIN_SEND_OK;
+  }
+
+  // Pipe is full, the node isn't keeping up
+  if(wr_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return ADMIN_SEND_DEFERRED;
+  }
+
+  // The node has gone away
+  return ADMIN_SEND_REJECTED;
+}
+
+void admin_channel_init(admin_channel *ch, int fd) {
+  int flags;
+
+  ch->fd = fd;
+  ch->deferred = NULL;
+  ch->deferred_count = 0;
+  ch->deferred_high_water = 0;
+  ch->sent = 0;
+  ch->deferrals = 0;
+  ch->rejected = 0;
+  pthread_mutex_init(&ch->lock, NULL);
+
+  // Keep only about a page of messages in flight in the pipe itself
+  fcntl(fd, F_SETPIPE_SZ, sizeof(message));
+
+  flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Writes deferred messages until the pipe is full, the caller holds the lock
+static int admin_channel_flush_locked(admin_channel *ch) {
+  while(ch->deferred != NULL) {
+    if(admin_channel_write(ch, ch->deferred->msg) != ADMIN_SEND_OK) {
+      break;
+    }
+
+    ch->deferred = message_complete(ch->deferred->msg, ch->deferred);
+    ch->deferred_count--;
+  }
+
+  return ch->deferred_count;
+}
+
+int admin_channel_flush(admin_channel *ch) {
+  int deferred;
+
+  pthread_mutex_lock(&ch->lock);
+  deferred = admin_channel_flush_locked(ch);
+  pthread_mutex_unlock(&ch->lock);
+
+  return deferred;
+}
+
+int admin_channel_deferred(admin_channel *ch) {
+  int deferred;
+
+  pthread_mutex_lock(&ch->lock);
+  deferred = ch->deferred_count;
+  pthread_mutex_unlock(&ch->lock);
+
+  return deferred;
+}
+
+int admin_channel_is_open(admin_channel *ch) {
+  int open;
+
+  pthread_mutex_lock(&ch->lock);
+  open = ch->fd >= 0;
+  pthread_mutex_unlock(&ch->lock);
+
+  return open;
+}
+
+int admin_channel_send(admin_channel *ch, message *msg, int max_deferred) {
+  int result = ADMIN_SEND_DEFERRED;
+
+  pthread_mutex_lock(&ch->lock);
+
+  if(ch->fd < 0) {
+    ch->rejected++;
+    pthread_mutex_unlock(&ch->lock);
+    return ADMIN_SEND_REJECTED;
+  }
+
+  // Older messages go first
+  if(admin_channel_flush_locked(ch) == 0) {
+    result = admin_channel_write(ch, msg);
+
+    if(result == ADMIN_SEND_OK) {
+      pthread_mutex_unlock(&ch->lock);
+      return result;
+    }
+  }
+
+  if(result == ADMIN_SEND_REJECTED || (max_deferred > 0 && ch->deferred_count >= max_deferred)) {
+    ch->rejected++;
+    pthread_mutex_unlock(&ch->lock);
+    return ADMIN_SEND_REJECTED;
+  }
+
+  // Hold on to the message until the node catches up
+  ch->deferred = message_queue_put_message(msg, ch->deferred);
+  ch->deferred_count++;
+  ch->deferrals++;
+
+  if(ch->deferred_count > ch->deferred_high_water) {
+    ch->deferred_high_water = ch->deferred_count;
+  }
+
+  pthread_mutex_unlock(&ch->lock);
+
+  return ADMIN_SEND_DEFERRED;
+}
+
+void admin_channel_close(admin_channel *ch) {
+  pthread_mutex_lock(&ch->lock);
+
+  if(ch->fd >= 0) {
+    close(ch->fd);
+    ch->fd = -1;
+  }
+
+  while(ch->deferred != NULL) {
+    ch->deferred = message_complete(ch->deferred->msg, ch->deferred);
+  }
+
+  ch->deferred_count = 0;
+
+  pthread_mutex_unlock(&ch->lock);
+}
+
+// Completion pipe reading thread
+static void *admin_completions_reader(void *completions_descriptor) {
+  admin_completions *ac = completions_descriptor;
+  message_completion rec;
+  int64_t latency_ns;
+
+  // Every record is written whole, so each read returns exactly one
+  while(read(ac->fd, &rec, sizeof(rec)) == sizeof(rec)) {
+    pthread_mutex_lock(&ac->lock);
+
+    switch(rec.status) {
+    case MESSAGE_DELIVERED:
+      ac->delivered++;
+
+      // A retransmitted message may be delivered twice
+      if(ac->outstanding > 0) {
+	ac->outstanding--;
+      }
+
+      latency_ns = rec.reported_ns - rec.created_ns;
+      ac->latency_total_ns += latency_ns;
+
+      if(latency_ns > ac->latency_max_ns) {
+	ac->latency_max_ns = latency_ns;
+      }
+      break;
+
+    case MESSAGE_COMPLETED:
+      ac->completed++;
+      break;
+
+    case MESSAGE_FORWARDED:
+      ac->forwarded++;
+      break;
+
+    case MESSAGE_UNDELIVERABLE:
+      ac->undeliverable++;
+
+      if(ac->outstanding > 0) {
+	ac->outstanding--;
+      }
+      break;
+
+    case MESSAGE_PAUSED:
+      ac->token_holder = rec.reporter_id;
+      ac->controls++;
+      break;
+
+    case MESSAGE_SNAPSHOTTED:
+      if(rec.message_id != 0) {
+	ac->control_failures++;
+      }
+
+      ac->controls++;
+      break;
+    }
+
+    pthread_cond_broadcast(&ac->changed);
+    pthread_mutex_unlock(&ac->lock);
+  }
+
+  // Every node has closed its end
+  pthread_mutex_lock(&ac->lock);
+  ac->open = 0;
+  pthread_cond_broadcast(&ac->changed);
+  pthread_mutex_unlock(&ac->lock);
+
+  return NULL;
+}
+
+int admin_completions_start(admin_completions *ac, int fd) {
+  sigset_t shutdown_signals, saved_signals;
+
+  ac->fd = fd;
+  ac->open = 1;
+  ac->outstanding = 0;
+  ac->delivered = 0;
+  ac->completed = 0;
+  ac->forwarded = 0;
+  ac->undeliverable = 0;
+  ac->latency_total_ns = 0;
+  ac->latency_max_ns = 0;
+  ac->controls = 0;
+  ac->control_failures = 0;
+  ac->token_holder = -1;
+  pthread_mutex_init(&ac->lock, NULL);
+  pthread_cond_init(&ac->changed, NULL);
+
+  // The reader leaves the shutdown signals to the prompt, so they interrupt its fgets
+  sigemptyset(&shutdown_signals);
+  sigaddset(&shutdown_signals, SIGINT);
+  sigaddset(&shutdown_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &shutdown_signals, &saved_signals);
+
+  if(pthread_create(&ac->reader_thread, NULL, admin_completions_reader, ac) != 0) {
+    pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+    return -1;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+
+  return 0;
+}
+
+void admin_completions_sent(admin_completions *ac) {
+  pthread_mutex_lock(&ac->lock);
+  ac->outstanding++;
+  pthread_mutex_unlock(&ac->lock);
+}
+
+void admin_completions_unsent(admin_completions *ac) {
+  pthread_mutex_lock(&ac->lock);
+
+  if(ac->outstanding > 0) {
+    ac->outstanding--;
+  }
+
+  pthread_mutex_unlock(&ac->lock);
+}
+
+// Waits for the next record, the deadline restarts with every record so only a stall gives up
+static int admin_completions_wait_record(admin_completions *ac, int timeout_ms) {
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  return pthread_cond_timedwait(&ac->changed, &ac->lock, &deadline) == ETIMEDOUT ? -1 : 0;
+}
+
+int admin_completions_wait(admin_completions *ac, int max_outstanding, int timeout_ms) {
+  int retval;
+
+  pthread_mutex_lock(&ac->lock);
+
+  while(ac->open && ac->outstanding >= max_outstanding) {
+    if(admin_completions_wait_record(ac, timeout_ms) != 0) {
+      pthread_mutex_unlock(&ac->lock);
+      return -1;
+    }
+  }
+
+  retval = ac->outstanding;
+  pthread_mutex_unlock(&ac->lock);
+
+  return retval;
+}
+
+int admin_completions_wait_controls(admin_completions *ac, unsigned long count, int timeout_ms) {
+  int retval = 0;
+
+  pthread_mutex_lock(&ac->lock);
+
+  while(ac->controls < count) {
+    if(!ac->open || admin_completions_wait_record(ac, timeout_ms) != 0) {
+      retval = -1;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&ac->lock);
+
+  return retval;
+}
+
+void admin_completions_snapshot(admin_completions *ac, unsigned long *delivered, int64_t *latency_total_ns) {
+  pthread_mutex_lock(&ac->lock);
+  *delivered = ac->delivered;
+  *latency_total_ns = ac->latency_total_ns;
+  pthread_mutex_unlock(&ac->lock);
+}
+
+void admin_completions_stop(admin_completions *ac) {
+  pthread_join(ac->reader_thread, NULL);
+  close(ac->fd);
+  ac->fd = -1;
+
+  printf("Completions: %lu delivered, %lu completed, %lu forwarded, %lu undeliverable, %d outstanding.\n",
+	 ac->delivered, ac->completed, ac->forwarded, ac->undeliverable, ac->outstanding);
+
+  if(ac->delivered > 0) {
+    printf("Delivery latency: %.3f ms average, %.3f ms max.\n",
+	   ac->latency_total_ns / 1e6 / ac->delivered, ac->latency_max_ns / 1e6);
+  }
+}
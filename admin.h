@@ -0,0 +1,181 @@
+/** @file admin.h
+ *  @brief Function prototypes and structure definitions for the admin library.
+ *
+ * The admin library is developed to let the admin
+ * process hand messages to the nodes without ever
+ * blocking on a node that is falling behind.
+ *
+ * Channels may be used by several threads at once (the
+ * prompt and the control socket clients).
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __ADMIN_H__
+#define __ADMIN_H__
+
+#include <pthread.h>
+
+#include "message.h"
+
+#define ADMIN_SEND_OK 0
+#define ADMIN_SEND_DEFERRED 1
+#define ADMIN_SEND_REJECTED -1
+
+// Admin process side of a node's admin pipe
+typedef struct admin_channel {
+  int fd;                     // Non-blocking write end of the admin pipe (-1 once closed)
+  message_queue *deferred;    // Messages waiting for room in the pipe
+  int deferred_count;
+  int deferred_high_water;
+  unsigned long sent;
+  unsigned long deferrals;
+  unsigned long rejected;
+  pthread_mutex_t lock;       // Serializes writers, so messages and deferrals stay in order
+} admin_channel;
+
+// Admin process side of the completion pipe shared by every node
+typedef struct admin_completions {
+  int fd;                     // Read end of the completion pipe
+  pthread_mutex_t lock;
+  pthread_cond_t changed;     // Signalled whenever a record arrives or the pipe closes
+  int open;                   // Cleared once every node has closed its end
+  int outstanding;            // Messages sent but not yet delivered
+  unsigned long delivered;
+  unsigned long completed;
+  unsigned long forwarded;
+  unsigned long undeliverable;  // Messages given up on because their destination failed
+  int64_t latency_total_ns;   // Creation to delivery, over every delivered message
+  int64_t latency_max_ns;
+  unsigned long controls;     // Snapshot steps reported by the nodes
+  int control_failures;       // Nodes that failed to write their snapshot section
+  int token_holder;           // Node that reported holding the token for a snapshot
+  pthread_t reader_thread;
+} admin_completions;
+
+/** @brief Prepares an admin channel for the supplied admin pipe.
+ *
+ *  Switches the write end to non-blocking mode and
+ *  shrinks the pipe so a full node queue is noticed
+ *  after only a few more messages.
+ *
+ *  @param ch The channel to be initialized.
+ *  @param fd The write end of the node's admin pipe.
+ *  @return Void.
+ */
+void admin_channel_init(admin_channel *ch, int fd);
+
+/** @brief Sends a message to the node without blocking.
+ *
+ *  Writes the message to the admin pipe if there is room.
+ *  Otherwise the message is deferred until a later flush,
+ *  unless max_deferred messages are already waiting, in
+ *  which case it is rejected. A copy of the message is
+ *  kept, so the caller still owns msg.
+ *
+ *  @param ch The channel to send on.
+ *  @param msg The message to be sent.
+ *  @param max_deferred The most messages allowed to wait (0 = unlimited).
+ *  @return ADMIN_SEND_OK, ADMIN_SEND_DEFERRED or ADMIN_SEND_REJECTED.
+ */
+int admin_channel_send(admin_channel *ch, message *msg, int max_deferred);
+
+/** @brief Writes as many deferred messages as the pipe will take.
+ *
+ *  @param ch The channel to be flushed.
+ *  @return The number of messages still deferred.
+ */
+int admin_channel_flush(admin_channel *ch);
+
+/** @brief Returns the number of messages waiting for room in the pipe.
+ *
+ *  @param ch The channel to check.
+ *  @return The number of deferred messages.
+ */
+int admin_channel_deferred(admin_channel *ch);
+
+/** @brief Returns whether the channel's node can still be sent to.
+ *
+ *  Safe to call while another thread closes the channel.
+ *
+ *  @param ch The channel to check.
+ *  @return 1 while the pipe is open, 0 once it is closed.
+ */
+int admin_channel_is_open(admin_channel *ch);
+
+/** @brief Closes the channel and drops any deferred messages.
+ *
+ *  The channel can still be used afterwards, every send
+ *  is rejected.
+ *  @param ch The channel to be closed.
+ *  @return Void.
+ */
+void admin_channel_close(admin_channel *ch);
+
+/** @brief Starts reading completion records from the nodes.
+ *
+ *  Spawns a thread that reads the completion pipe and keeps
+ *  the delivery counters and latencies up to date until
+ *  every node has closed its end of the pipe.
+ *
+ *  @param ac The completion tracker to be started.
+ *  @param fd The read end of the completion pipe.
+ *  @return Zero on success, -1 if the thread could not be created.
+ */
+int admin_completions_start(admin_completions *ac, int fd);
+
+/** @brief Records that a message is about to be handed to a node.
+ *
+ *  Must be called before the message is sent, since it may
+ *  be delivered before the send returns.
+ *
+ *  @param ac The completion tracker.
+ *  @return Void.
+ */
+void admin_completions_sent(admin_completions *ac);
+
+/** @brief Takes back admin_completions_sent for a message that was rejected.
+ *
+ *  @param ac The completion tracker.
+ *  @return Void.
+ */
+void admin_completions_unsent(admin_completions *ac);
+
+/** @brief Waits until fewer than max_outstanding messages are undelivered.
+ *
+ *  @param ac The completion tracker.
+ *  @param max_outstanding The number of undelivered messages to wait below.
+ *  @param timeout_ms Milliseconds to wait for the next record before giving up.
+ *  @return The number of undelivered messages, or -1 if no record arrived in time.
+ */
+int admin_completions_wait(admin_completions *ac, int max_outstanding, int timeout_ms);
+
+/** @brief Waits until the nodes have reported count snapshot steps in total.
+ *
+ *  @param ac The completion tracker.
+ *  @param count The number of steps to wait for.
+ *  @param timeout_ms Milliseconds to wait for the next step before giving up.
+ *  @return Zero once count steps have been reported, -1 on timeout.
+ */
+int admin_completions_wait_controls(admin_completions *ac, unsigned long count, int timeout_ms);
+
+/** @brief Copies the delivery count and total latency.
+ *
+ *  @param ac The completion tracker.
+ *  @param delivered Set to the number of messages delivered.
+ *  @param latency_total_ns Set to the summed creation to delivery latency.
+ *  @return Void.
+ */
+void admin_completions_snapshot(admin_completions *ac, unsigned long *delivered, int64_t *latency_total_ns);
+
+/** @brief Waits for the reader to see every node close the pipe, then prints the totals.
+ *
+ *  Must only be called once the nodes have exited.
+ *
+ *  @param ac The completion tracker to be stopped.
+ *  @return Void.
+ */
+void admin_completions_stop(admin_completions *ac);
+
+#endif // __ADMIN_H__
@@ -0,0 +1,228 @@
+/** @file bench.c
+ *  @brief Microbenchmarks for the message and endpoint libraries.
+ *
+ * Times the library primitives on their own, outside of
+ * the simulator, over a range of queue depths and endpoint
+ * list sizes. Reports the cost of each operation in ns/op
+ * and allocs/op so data structure changes can be judged
+ * by numbers.
+ *
+ * malloc is wrapped at link time (see the bench target in
+ * the makefile) to count allocations.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "endpoint.h"
+#include "message.h"
+
+#define BENCH_MAX_SIZE_DEFAULT 10000   // Queue puts and list adds walk the whole list, 100000 takes minutes
+#define BENCH_MAX_SIZE_LIMIT 100000000  // Keeps the size sweep (size *= 10) inside an int
+#define BENCH_MIN_OPS 100000  // Small sizes are repeated until at least this many operations are timed
+
+// Allocation counter, see __wrap_malloc
+static unsigned long bench_allocs = 0;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size) {
+  bench_allocs++;
+  return __real_malloc(size);
+}
+
+// A running measurement
+typedef struct bench_timer {
+  struct timespec start;
+  unsigned long start_allocs;
+  double total_ns;
+  unsigned long allocs;
+  unsigned long ops;
+} bench_timer;
+
+static void bench_timer_reset(bench_timer *t) {
+  t->total_ns = 0;
+  t->allocs = 0;
+  t->ops = 0;
+}
+
+static void bench_timer_start(bench_timer *t) {
+  t->start_allocs = bench_allocs;
+  clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+static void bench_timer_stop(bench_timer *t, unsigned long ops) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  t->total_ns += (end.tv_sec - t->start.tv_sec) * 1e9 + (end.tv_nsec - t->start.tv_nsec);
+  t->allocs += bench_allocs - t->start_allocs;
+  t->ops += ops;
+}
+
+static void bench_report(const char *name, int size, bench_timer *t) {
+  printf("%-28s %8d %12lu %12.1f %10.2f\n", name, size, t->ops, t->total_ns / t->ops, (double)t->allocs / t->ops);
+  fflush(stdout);
+}
+
+// Times filling, reading and draining a message queue of the supplied depth
+static void bench_message_queue(int depth) {
+  bench_timer create_timer, put_timer, get_timer, complete_timer;
+  message **msgs = malloc(depth * sizeof(message *));
+  message_queue *head;
+  message *msg;
+  int rounds = depth < BENCH_MIN_OPS ? BENCH_MIN_OPS / depth : 1;
+  int round_iterator, msg_iterator;
+
+  bench_timer_reset(&create_timer);
+  bench_timer_reset(&put_timer);
+  bench_timer_reset(&get_timer);
+  bench_timer_reset(&complete_timer);
+
+  for(round_iterator=0; round_iterator<rounds; round_iterator++) {
+    head = NULL;
+
+    bench_timer_start(&create_timer);
+    for(msg_iterator=0; msg_iterator<depth; msg_iterator++) {
+      msgs[msg_iterator] = message_create(msg_iterator % 16, "benchmark message body");
+    }
+    bench_timer_stop(&create_timer, depth);
+
+    // The queue keeps its own copy of every message
+    bench_timer_start(&put_timer);
+    for(msg_iterator=0; msg_iterator<depth; msg_iterator++) {
+      head = message_queue_put_message(msgs[msg_iterator], head);
+    }
+    bench_timer_stop(&put_timer, depth);
+
+    bench_timer_start(&get_timer);
+    for(msg_iterator=0; msg_iterator<depth; msg_iterator++) {
+      msg = message_queue_get_message(head);
+    }
+    bench_timer_stop(&get_timer, depth);
+
+    bench_timer_start(&complete_timer);
+    for(msg_iterator=0; msg_iterator<depth; msg_iterator++) {
+      msg = message_queue_get_message(head);
+      head = message_complete(msg, head);
+    }
+    bench_timer_stop(&complete_timer, depth);
+
+    for(msg_iterator=0; msg_iterator<depth; msg_iterator++) {
+      free(msgs[msg_iterator]);
+    }
+  }
+
+  bench_report("message_create", depth, &create_timer);
+  bench_report("message_queue_put_message", depth, &put_timer);
+  bench_report("message_queue_get_message", depth, &get_timer);
+  bench_report("message_complete", depth, &complete_timer);
+
+  free(msgs);
+}
+
+// Times computing the frame check sequence of a full size message
+static void bench_message_fcs(void) {
+  bench_timer fcs_timer;
+  message *msg = message_create(1, "");
+  int msg_iterator;
+
+  memset(msg->body, 'x', MESSAGE_MAX_BODY_LENGTH - 1);
+  bench_timer_reset(&fcs_timer);
+
+  bench_timer_start(&fcs_timer);
+  for(msg_iterator=0; msg_iterator<BENCH_MIN_OPS; msg_iterator++) {
+    msg->body[0] = msg_iterator;
+    message_seal(msg);
+  }
+  bench_timer_stop(&fcs_timer, BENCH_MIN_OPS);
+
+  bench_report("message_seal", sizeof(message), &fcs_timer);
+
+  free(msg);
+}
+
+// Times building an endpoint list of the supplied size in token id order
+static void bench_endpoint_list(int size) {
+  bench_timer add_timer;
+  endpoint_list *head;
+  endpoint endp;
+  int rounds = size < BENCH_MIN_OPS ? BENCH_MIN_OPS / size : 1;
+  int round_iterator, endpoint_iterator;
+
+  // No pipes are created, so recycling has nothing to close
+  memset(&endp, 0, sizeof(endp));
+  endp.token_pipe[PIPE_READ_INDEX] = endp.token_pipe[PIPE_WRITE_INDEX] = -1;
+  endp.admin_pipe[PIPE_READ_INDEX] = endp.admin_pipe[PIPE_WRITE_INDEX] = -1;
+  endp.alt_token_pipe[PIPE_READ_INDEX] = endp.alt_token_pipe[PIPE_WRITE_INDEX] = -1;
+  endp.alt_ring_id = -1;
+
+  bench_timer_reset(&add_timer);
+
+  for(round_iterator=0; round_iterator<rounds; round_iterator++) {
+    head = NULL;
+
+    bench_timer_start(&add_timer);
+    for(endpoint_iterator=0; endpoint_iterator<size; endpoint_iterator++) {
+      endp.token_id = endpoint_iterator + 1;
+      head = endpoint_list_add(head, &endp);
+    }
+    bench_timer_stop(&add_timer, size);
+
+    endpoint_list_recycle(head);
+  }
+
+  bench_report("endpoint_list_add", size, &add_timer);
+}
+
+int main(int argc, char *argv[]) {
+  int max_size = BENCH_MAX_SIZE_DEFAULT;
+  long parsed;
+  char *end;
+  int size;
+  int opt;
+
+  while((opt = getopt(argc, argv, "m:h")) != -1) {
+    switch(opt) {
+    case 'm':
+      parsed = strtol(optarg, &end, 10);
+
+      if(end == optarg || *end != '\0' || parsed <= 0 || parsed > BENCH_MAX_SIZE_LIMIT) {
+	fprintf(stderr, "ERROR: Invalid maximum size '%s', it must be between 1 and %d.\n", optarg, BENCH_MAX_SIZE_LIMIT);
+	return 1;
+      }
+
+      max_size = (int)parsed;
+      break;
+
+    default:
+      fprintf(stderr, "Usage: %s [-m max_size]\n", argv[0]);
+      fprintf(stderr, "  -m  Largest queue depth and endpoint list size to time (default %d, at most %d)\n", BENCH_MAX_SIZE_DEFAULT, BENCH_MAX_SIZE_LIMIT);
+      return 1;
+    }
+  }
+
+  printf("%-28s %8s %12s %12s %10s\n", "operation", "size", "ops", "ns/op", "allocs/op");
+
+  // Queue depths from 1 to max_size
+  for(size=1; size<=max_size; size*=10) {
+    bench_message_queue(size);
+  }
+
+  // Frame check sequence over the largest possible frame
+  bench_message_fcs();
+
+  // Endpoint lists from 10 to max_size
+  for(size=10; size<=max_size; size*=10) {
+    bench_endpoint_list(size);
+  }
+
+  return 0;
+}
@@ -0,0 +1,435 @@
+/** @file control.c
+ *  @brief Function definitions for the control library.
+ *
+ * The control library is developed to let scripts and
+ * load generators drive the admin process over a local
+ * UNIX socket, alongside the interactive prompt. Every
+ * client is served by its own thread, so clients don't
+ * wait for each other.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "endpoint.h"
+
+// How often the accept thread wakes up to flush deferred messages and check for a stop
+#define CONTROL_POLL_MS 100
+
+// How long a burst waits for a saturated node to make room before giving up on a message
+#define CONTROL_BURST_STALL_MS 5000
+#define CONTROL_BURST_RETRY_NS 1000000
+
+// Handed to each client thread
+typedef struct control_client {
+  control_server *cs;
+  int slot;
+  int fd;
+} control_client;
+
+// Writes a whole reply, giving up if the client has gone away
+static void control_reply(int fd, const char *reply) {
+  size_t len = strlen(reply);
+  ssize_t wr_len;
+
+  while(len > 0) {
+    wr_len = send(fd, reply, len, MSG_NOSIGNAL);
+
+    if(wr_len < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if(wr_len <= 0) {
+      return;
+    }
+
+    reply += wr_len;
+    len -= wr_len;
+  }
+}
+
+// Parses an endpoint id, returns its channel or NULL if there is no such endpoint
+static admin_channel *control_channel(control_server *cs, const char *text, char **end) {
+  long token_id = strtol(text, end, 10);
+
+  if(*end == text || token_id < ENDPOINT_BASE_ADDR || token_id >= cs->channel_count + ENDPOINT_BASE_ADDR) {
+    return NULL;
+  }
+
+  return &cs->channels[token_id - ENDPOINT_BASE_ADDR];
+}
+
+// Hands a message to the source node, returns ADMIN_SEND_OK, ADMIN_SEND_DEFERRED or ADMIN_SEND_REJECTED
+static int control_send(control_server *cs, admin_channel *source, message *msg) {
+  int result;
+
+  pthread_mutex_lock(&cs->send_lock);
+
+  // Counted before sending, so a quick delivery can't be seen first
+  admin_completions_sent(cs->completions);
+  result = admin_channel_send(source, msg, cs->max_deferred);
+
+  if(result == ADMIN_SEND_REJECTED) {
+    admin_completions_unsent(cs->completions);
+  }
+
+  pthread_mutex_unlock(&cs->send_lock);
+
+  return result;
+}
+
+// Sends a message, waiting while the node is saturated (only this client waits)
+static int control_send_patiently(control_server *cs, admin_channel *source, message *msg) {
+  struct timespec retry_interval = {0, CONTROL_BURST_RETRY_NS};
+  long waited_ns = 0;
+  int result = control_send(cs, source, msg);
+
+  while(result == ADMIN_SEND_REJECTED && admin_channel_is_open(source) && cs->running && waited_ns < CONTROL_BURST_STALL_MS * 1000000L) {
+    nanosleep(&retry_interval, NULL);
+    waited_ns += CONTROL_BURST_RETRY_NS;
+
+    result = control_send(cs, source, msg);
+  }
+
+  return result;
+}
+
+// Carries out one command line and writes the reply into reply
+static void control_handle(control_server *cs, char *line, char *reply, size_t reply_length) {
+  char body[MESSAGE_MAX_BODY_LENGTH];
+  admin_channel *source;
+  message *msg;
+  admin_completions *ac = cs->completions;
+  char *args, *end;
+  long destination_id, count, accepted, deferred, burst_iterator;
+  int message_id = 0;
+  int result = ADMIN_SEND_REJECTED;
+
+  pthread_mutex_lock(&cs->lock);
+  cs->commands++;
+  pthread_mutex_unlock(&cs->lock);
+
+  // send <from> <to> <message>, burst <from> <to> <count> [message]
+  if(strncmp(line, "send ", 5) == 0 || strncmp(line, "burst ", 6) == 0) {
+    args = line + (line[0] == 's' ? 5 : 6);
+    source = control_channel(cs, args, &end);
+    destination_id = strtol(end, &args, 10);
+    count = 1;
+
+    if(source == NULL || args == end || destination_id < ENDPOINT_BASE_ADDR || destination_id >= cs->channel_count + ENDPOINT_BASE_ADDR) {
+      snprintf(reply, reply_length, "error endpoints must be between %d and %d\n", ENDPOINT_BASE_ADDR, cs->channel_count + ENDPOINT_BASE_ADDR - 1);
+      return;
+    }
+
+    if(line[0] == 'b') {
+      count = strtol(args, &end, 10);
+
+      if(end == args || count < 1) {
+	snprintf(reply, reply_length, "error usage: burst <from> <to> <count> [message]\n");
+	return;
+      }
+
+      args = end;
+    }
+
+    while(*args == ' ') {
+      args++;
+    }
+
+    // Bodies from the prompt end in a newline, the nodes print them as is
+    snprintf(body, sizeof(body) - 1, "%s", *args != '\0' ? args : "Control socket message");
+    strcat(body, "\n");
+
+    if(!admin_channel_is_open(source)) {
+      snprintf(reply, reply_length, "error endpoint %d has failed\n", (int)(source - cs->channels) + ENDPOINT_BASE_ADDR);
+      return;
+    }
+
+    for(burst_iterator=0, accepted=0, deferred=0; burst_iterator<count; burst_iterator++) {
+      msg = message_create(destination_id, body);
+      message_id = msg->message_id;
+
+      // A single send reports a saturated node straight away, a burst waits for it to catch up
+      result = line[0] == 'b' ? control_send_patiently(cs, source, msg) : control_send(cs, source, msg);
+
+      // Deferred messages are still in the admin process, and are lost if it shuts down first
+      if(result == ADMIN_SEND_OK) {
+	accepted++;
+      }
+      else if(result == ADMIN_SEND_DEFERRED) {
+	deferred++;
+      }
+
+      free(msg);
+    }
+
+    if(line[0] == 'b') {
+      snprintf(reply, reply_length, "ok %ld %ld %ld\n", accepted, deferred, count - accepted - deferred);
+    }
+    else if(result == ADMIN_SEND_REJECTED) {
+      snprintf(reply, reply_length, "error endpoint is saturated\n");
+    }
+    else {
+      snprintf(reply, reply_length, "%s %d\n", result == ADMIN_SEND_OK ? "ok" : "deferred", message_id);
+    }
+  }
+
+  else if(strcmp(line, "stats") == 0) {
+    pthread_mutex_lock(&ac->lock);
+    snprintf(reply, reply_length, "ok delivered %lu completed %lu forwarded %lu outstanding %d latency_avg_ms %.3f latency_max_ms %.3f undeliverable %lu\n",
+	     ac->delivered, ac->completed, ac->forwarded, ac->outstanding,
+	     ac->delivered ? ac->latency_total_ns / 1e6 / ac->delivered : 0.0, ac->latency_max_ns / 1e6, ac->undeliverable);
+    pthread_mutex_unlock(&ac->lock);
+  }
+
+  // The prompt is interrupted the same way as by ^C
+  else if(strcmp(line, "quit") == 0) {
+    snprintf(reply, reply_length, "ok\n");
+    kill(getpid(), SIGTERM);
+  }
+
+  else {
+    snprintf(reply, reply_length, "error unknown command\n");
+  }
+}
+
+// Client thread, reads commands until the client disconnects or the server stops
+static void *control_client_handler(void *client_descriptor) {
+  control_client *client = client_descriptor;
+  control_server *cs = client->cs;
+  char *line = malloc(CONTROL_LINE_LENGTH);
+  char *reply = malloc(CONTROL_LINE_LENGTH);
+  char *newline;
+  size_t buffered = 0;
+  ssize_t rd_len;
+  int discarding = 0;
+
+  while((rd_len = read(client->fd, line + buffered, CONTROL_LINE_LENGTH - 1 - buffered)) > 0 || (rd_len < 0 && errno == EINTR)) {
+    if(rd_len < 0) {
+      continue;
+    }
+
+    buffered += rd_len;
+    line[buffered] = '\0';
+
+    // Carry out every complete line
+    while((newline = strchr(line, '\n')) != NULL) {
+      *newline = '\0';
+
+      if(newline > line && newline[-1] == '\r') {
+	newline[-1] = '\0';
+      }
+
+      if(discarding) {
+	discarding = 0;
+      }
+      else if(line[0] != '\0') {
+	control_handle(cs, line, reply, CONTROL_LINE_LENGTH);
+	control_reply(client->fd, reply);
+      }
+
+      buffered -= newline + 1 - line;
+      memmove(line, newline + 1, buffered + 1);
+    }
+
+    // A line that doesn't fit is refused as a whole
+    if(buffered == CONTROL_LINE_LENGTH - 1) {
+      if(!discarding) {
+	control_reply(client->fd, "error line too long\n");
+      }
+
+      discarding = 1;
+      buffered = 0;
+    }
+  }
+
+  pthread_mutex_lock(&cs->lock);
+  close(client->fd);
+  cs->client_fds[client->slot] = -1;
+  cs->client_count--;
+  pthread_cond_broadcast(&cs->client_left);
+  pthread_mutex_unlock(&cs->lock);
+
+  free(line);
+  free(reply);
+  free(client);
+
+  return NULL;
+}
+
+// Takes a new client, or turns it away if there are too many
+static void control_accept(control_server *cs) {
+  control_client *client;
+  pthread_t client_thread;
+  int client_fd = accept4(cs->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  int slot;
+
+  if(client_fd < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&cs->lock);
+
+  for(slot=0; slot<CONTROL_MAX_CLIENTS && cs->client_fds[slot] >= 0; slot++);
+
+  if(slot == CONTROL_MAX_CLIENTS) {
+    pthread_mutex_unlock(&cs->lock);
+    control_reply(client_fd, "error too many clients\n");
+    close(client_fd);
+    return;
+  }
+
+  client = malloc(sizeof(control_client));
+  client->cs = cs;
+  client->slot = slot;
+  client->fd = client_fd;
+
+  if(pthread_create(&client_thread, NULL, control_client_handler, client) != 0) {
+    pthread_mutex_unlock(&cs->lock);
+    control_reply(client_fd, "error out of threads\n");
+    close(client_fd);
+    free(client);
+    return;
+  }
+
+  pthread_detach(client_thread);
+  cs->client_fds[slot] = client_fd;
+  cs->client_count++;
+  pthread_mutex_unlock(&cs->lock);
+}
+
+// Accept thread
+static void *control_accept_handler(void *server_descriptor) {
+  control_server *cs = server_descriptor;
+  struct pollfd listener = {cs->listen_fd, POLLIN, 0};
+  int channel_iterator;
+
+  while(cs->running) {
+    if(poll(&listener, 1, CONTROL_POLL_MS) > 0) {
+      control_accept(cs);
+      continue;
+    }
+
+    // Nobody else flushes while the prompt is waiting for input (the prompt flushes itself while holding the server)
+    if(pthread_mutex_trylock(&cs->send_lock) != 0) {
+      continue;
+    }
+
+    for(channel_iterator=0; channel_iterator<cs->channel_count; channel_iterator++) {
+      admin_channel_flush(&cs->channels[channel_iterator]);
+    }
+
+    pthread_mutex_unlock(&cs->send_lock);
+  }
+
+  return NULL;
+}
+
+int control_server_start(control_server *cs, const char *path, admin_channel *channels, int channel_count, admin_completions *completions, int max_deferred) {
+  struct sockaddr_un addr;
+  sigset_t shutdown_signals, saved_signals;
+  int slot;
+
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+
+  cs->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if(cs->listen_fd < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  // A socket left behind by an earlier run is replaced
+  unlink(path);
+
+  if(bind(cs->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(cs->listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+    close(cs->listen_fd);
+    return -1;
+  }
+
+  strcpy(cs->path, path);
+  cs->channels = channels;
+  cs->channel_count = channel_count;
+  cs->completions = completions;
+  cs->max_deferred = max_deferred;
+  cs->running = 1;
+  cs->client_count = 0;
+  cs->commands = 0;
+  pthread_mutex_init(&cs->lock, NULL);
+  pthread_mutex_init(&cs->send_lock, NULL);
+  pthread_cond_init(&cs->client_left, NULL);
+
+  for(slot=0; slot<CONTROL_MAX_CLIENTS; slot++) {
+    cs->client_fds[slot] = -1;
+  }
+
+  // Control threads (and the client threads they start) leave the shutdown signals to the prompt
+  sigemptyset(&shutdown_signals);
+  sigaddset(&shutdown_signals, SIGINT);
+  sigaddset(&shutdown_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &shutdown_signals, &saved_signals);
+
+  if(pthread_create(&cs->accept_thread, NULL, control_accept_handler, cs) != 0) {
+    pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+    close(cs->listen_fd);
+    unlink(path);
+    return -1;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+
+  return 0;
+}
+
+void control_server_hold(control_server *cs) {
+  pthread_mutex_lock(&cs->send_lock);
+}
+
+void control_server_release(control_server *cs) {
+  pthread_mutex_unlock(&cs->send_lock);
+}
+
+void control_server_stop(control_server *cs) {
+  int slot;
+
+  cs->running = 0;
+  pthread_join(cs->accept_thread, NULL);
+
+  // Wake every client thread out of its read
+  pthread_mutex_lock(&cs->lock);
+
+  for(slot=0; slot<CONTROL_MAX_CLIENTS; slot++) {
+    if(cs->client_fds[slot] >= 0) {
+      shutdown(cs->client_fds[slot], SHUT_RDWR);
+    }
+  }
+
+  while(cs->client_count > 0) {
+    pthread_cond_wait(&cs->client_left, &cs->lock);
+  }
+
+  pthread_mutex_unlock(&cs->lock);
+
+  close(cs->listen_fd);
+  unlink(cs->path);
+
+  printf("Control socket: %lu commands handled.\n", cs->commands);
+}
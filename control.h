@@ -0,0 +1,103 @@
+/** @file control.h
+ *  @brief Function prototypes and structure definitions for the control library.
+ *
+ * The control library is developed to let scripts and
+ * load generators drive the admin process over a local
+ * UNIX socket, alongside the interactive prompt. Every
+ * client is served by its own thread, so clients don't
+ * wait for each other.
+ *
+ * Clients send one command per line and get one line back:
+ *
+ *   send <from> <to> <message>           ok <id> | deferred <id> | error <reason>
+ *   burst <from> <to> <count> [message]  ok <accepted> <deferred> <rejected> | error <reason>
+ *   stats                                ok delivered <n> completed <n> forwarded <n> outstanding <n> ...
+ *   quit                                 ok, then the simulator shuts down
+ *
+ * A burst waits for a saturated node to make room (up to
+ * 5 seconds per message), a single send doesn't. Sends wait
+ * while the admin process holds the server for a snapshot.
+ * Accepted messages have reached the node's admin pipe.
+ * Deferred ones are still held by the admin process and
+ * are abandoned if it shuts down before they are handed over.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <pthread.h>
+
+#include "admin.h"
+
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_LINE_LENGTH (MESSAGE_MAX_BODY_LENGTH + 64)
+#define CONTROL_PATH_LENGTH 108  // sun_path of a sockaddr_un
+
+// The admin process side of the control socket
+typedef struct control_server {
+  int listen_fd;
+  char path[CONTROL_PATH_LENGTH];
+  admin_channel *channels;      // Admin channel of every node, indexed by token id - ENDPOINT_BASE_ADDR
+  int channel_count;
+  admin_completions *completions;
+  int max_deferred;             // Passed on to admin_channel_send
+  volatile int running;
+  pthread_mutex_t lock;
+  pthread_mutex_t send_lock;    // Taken around every send and flush, held by control_server_hold
+  pthread_cond_t client_left;
+  int client_fds[CONTROL_MAX_CLIENTS];  // -1 for a free entry
+  int client_count;
+  unsigned long commands;       // Commands handled, over every client
+  pthread_t accept_thread;
+} control_server;
+
+/** @brief Starts listening on a UNIX socket for control clients.
+ *
+ *  Any existing file at path is replaced. The accept
+ *  thread also flushes deferred messages while the
+ *  prompt is waiting for input. The shutdown signals are
+ *  blocked in every control thread, so they still reach
+ *  the prompt. quit raises SIGTERM in the admin process.
+ *
+ *  @param cs The server to be started.
+ *  @param path Where to create the socket.
+ *  @param channels The admin channel of every node.
+ *  @param channel_count The number of channels.
+ *  @param completions The completion tracker to report sends and stats to.
+ *  @param max_deferred The most messages allowed to wait per channel (0 = unlimited).
+ *  @return Zero on success, -1 if the socket can't be created.
+ */
+int control_server_start(control_server *cs, const char *path, admin_channel *channels, int channel_count, admin_completions *completions, int max_deferred);
+
+/** @brief Stops every client from sending to the nodes until released.
+ *
+ *  Waits for any send in progress to finish. Clients that
+ *  send in the meantime wait for control_server_release,
+ *  and deferred messages aren't flushed, so the nodes only
+ *  get what the caller sends them.
+ *
+ *  @param cs The server to be held.
+ *  @return Void.
+ */
+void control_server_hold(control_server *cs);
+
+/** @brief Lets clients send to the nodes again after control_server_hold.
+ *
+ *  @param cs The server to be released.
+ *  @return Void.
+ */
+void control_server_release(control_server *cs);
+
+/** @brief Disconnects every client, stops listening and removes the socket.
+ *
+ *  Must be called before the channels are closed.
+ *
+ *  @param cs The server to be stopped.
+ *  @return Void.
+ */
+void control_server_stop(control_server *cs);
+
+#endif // __CONTROL_H__
@@ -14,6 +14,17 @@
 
 #include "endpoint.h"
 
+// Closes both ends of a pipe, skipping ends already marked closed
+static void endpoint_close_pipe(int pipe_fd[2]) {
+  if(pipe_fd[PIPE_READ_INDEX] >= 0) {
+    close(pipe_fd[PIPE_READ_INDEX]);
+  }
+
+  if(pipe_fd[PIPE_WRITE_INDEX] >= 0) {
+    close(pipe_fd[PIPE_WRITE_INDEX]);
+  }
+}
+
 int request_num_endpoints(void) {
   // Add one to endpoint string length to ensure string is null terminated
   // SEE: fgets documentation for reasoning
@@ -31,10 +42,11 @@ int request_num_endpoints(void) {
   return num_endpoints;
 }
 
-endpoint *create_endpoint(int id) {
+endpoint *create_endpoint(int id, int ring_id, int alt_ring_id) {
 
   int admin_pipe[2];
   int token_pipe[2];
+  int alt_token_pipe[2] = {-1, -1};
 
   // Create admin write pipe and handle pipe creation errors
   if(pipe(admin_pipe) != 0) {
@@ -46,6 +58,11 @@ endpoint *create_endpoint(int id) {
     return NULL;
   }
 
+  // Create the second ring's token pipe for bridge endpoints
+  if(alt_ring_id >= 0 && pipe(alt_token_pipe) != 0) {
+    return NULL;
+  }
+
   // Create a new process
   int pid = fork();
 
@@ -58,10 +75,13 @@ endpoint *create_endpoint(int id) {
 
   retval->pid = pid;
   retval->token_id  = id;
+  retval->ring_id = ring_id;
+  retval->alt_ring_id = alt_ring_id;
 
   // Copy pipe data into struct
   memcpy(retval->token_pipe, token_pipe, sizeof(retval->token_pipe));
   memcpy(retval->admin_pipe, admin_pipe, sizeof(retval->admin_pipe));
+  memcpy(retval->alt_token_pipe, alt_token_pipe, sizeof(retval->alt_token_pipe));
 
   /* retval->token_pipe = memcpy(retval->token_pipe, token_pipe, sizeof(retval->token_pipe)); */
   /* retval->admin_pipe = memcpy(retval->admin_pipe, admin_pipe, sizeof(retval->admin_pipe)); */
@@ -175,6 +195,24 @@ endpoint_list *endpoint_list_add(endpoint_list *endpoint_list_head, endpoint *to
   }
 }
 
+endpoint *endpoint_list_find(endpoint_list *head, int token_id) {
+  endpoint_list *temp = head;
+
+  if(temp == NULL) {
+    return NULL;
+  }
+
+  do {
+    if(temp->endp->token_id == token_id) {
+      return temp->endp;
+    }
+
+    temp = temp->next;
+  } while(temp != head);
+
+  return NULL;
+}
+
 void endpoint_list_recycle(endpoint_list *endpoint_list_head) {
   endpoint_list *temp = endpoint_list_head;
   endpoint_list *temp_next = temp;
@@ -195,13 +233,12 @@ void endpoint_list_recycle(endpoint_list *endpoint_list_head) {
     // Retain a handle to the next element in the list
     temp_next = temp->next;
 
-    // Close token pipe handles
-    close(temp->endp->token_pipe[0]);
-    close(temp->endp->token_pipe[1]);
+    // Close token pipe handles (-1 marks handles that were already closed)
+    endpoint_close_pipe(temp->endp->token_pipe);
+    endpoint_close_pipe(temp->endp->alt_token_pipe);
 
     // Close admin write pipe handles
-    close(temp->endp->admin_pipe[0]);
-    close(temp->endp->admin_pipe[1]);
+    endpoint_close_pipe(temp->endp->admin_pipe);
 
     // Free the memory used
     free(temp->endp);
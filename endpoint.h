@@ -16,13 +16,17 @@
 #define PIPE_WRITE_INDEX 1
 
 #define ENDPOINT_STRING_LENGTH 10
+#define ENDPOINT_BASE_ADDR 1  // Token id of the first endpoint
 
 // Single endpoint
 typedef struct endpoint {
   int pid;
   int token_id;
+  int ring_id;
   int token_pipe[2];
   int admin_pipe[2];
+  int alt_ring_id;        // Second ring joined by a bridge endpoint (-1 when unused)
+  int alt_token_pipe[2];  // Token pipe on the second ring
 } endpoint;
 
 // Doubly linked list for management purposes
@@ -50,12 +54,15 @@ int request_num_endpoints(void);
  *  struct is returned. The endpoint pid value will be zero
  *  if the process the program is currently in is the child
  *  process(return value of fork). The function will return
- *  a NULL pointer on process creation failure.
+ *  a NULL pointer on process creation failure. A second
+ *  token pipe is created when alt_ring_id is not negative.
  *
  *  @param id The token ring endpoint id.
+ *  @param ring_id The ring the endpoint belongs to.
+ *  @param alt_ring_id The second ring joined by a bridge endpoint, or -1.
  *  @return The token ring endpoint descriptor struct.
  */
-endpoint *create_endpoint(int id);
+endpoint *create_endpoint(int id, int ring_id, int alt_ring_id);
 
 /** @brief Adds token endpoint supplied to the supplied endpoint list.
  *
@@ -69,6 +76,14 @@ endpoint *create_endpoint(int id);
  */
 endpoint_list *endpoint_list_add(endpoint_list *endpoint_list_head, endpoint *token_endpoint);
 
+/** @brief Finds the endpoint with the supplied token id.
+ *
+ *  @param head A pointer to an element in the list to be searched.
+ *  @param token_id The token id of the endpoint to be found.
+ *  @return The endpoint stored in the list, or a NULL pointer if not found.
+ */
+endpoint *endpoint_list_find(endpoint_list *head, int token_id);
+
 /** @brief Handles the resource cleanup for an endpoint list
  *
  *  Closes all open file handles and free's all space consumed
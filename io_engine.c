@@ -0,0 +1,311 @@
+/** @file io_engine.c
+ *  @brief Function definitions for the io engine library.
+ *
+ * The io engine library is developed to let a token ring
+ * thread pass the token on and wait for the next one with
+ * a single system call, by submitting the hop delay, the
+ * token write and the next token read to io_uring as one
+ * linked batch. A second, unrelated read (the admin pipe)
+ * can be kept outstanding on the same ring.
+ *
+ * liburing isn't required, the ring is driven with the raw
+ * io_uring_setup and io_uring_enter system calls.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "io_engine.h"
+
+// Operation tags carried in user_data
+#define IO_ENGINE_TAG_DELAY 1
+#define IO_ENGINE_TAG_WRITE 2
+#define IO_ENGINE_TAG_READ 3
+#define IO_ENGINE_TAG_AUX 4
+
+static int io_engine_setup(unsigned entries, struct io_uring_params *params) {
+#ifdef __NR_io_uring_setup
+  return syscall(__NR_io_uring_setup, entries, params);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int io_engine_enter(io_engine *e, unsigned min_complete) {
+  int submitted;
+
+  // Publish the queued entries before the kernel looks at them
+  __atomic_store_n(e->sq_tail, e->sq_local_tail, __ATOMIC_RELEASE);
+
+  do {
+    e->enters++;
+    submitted = syscall(__NR_io_uring_enter, e->ring_fd, e->to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+  } while(submitted < 0 && errno == EINTR);
+
+  if(submitted < 0) {
+    return -1;
+  }
+
+  e->to_submit -= submitted;
+
+  return 0;
+}
+
+// Returns a cleared submission queue entry, or NULL if the queue is full
+static struct io_uring_sqe *io_engine_next_sqe(io_engine *e, int tag) {
+  unsigned head = __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE);
+  unsigned index = e->sq_local_tail & e->sq_mask;
+  struct io_uring_sqe *sqe;
+
+  if(e->sq_local_tail - head >= e->sq_entries) {
+    return NULL;
+  }
+
+  sqe = &e->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = tag;
+
+  e->sq_array[index] = index;
+  e->sq_local_tail++;
+  e->to_submit++;
+
+  return sqe;
+}
+
+// Records the result of every finished operation
+static void io_engine_reap(io_engine *e) {
+  unsigned head = *e->cq_head;
+  unsigned tail = __atomic_load_n(e->cq_tail, __ATOMIC_ACQUIRE);
+  struct io_uring_cqe *cqe;
+
+  while(head != tail) {
+    cqe = &e->cqes[head & e->cq_mask];
+
+    switch(cqe->user_data) {
+    case IO_ENGINE_TAG_DELAY:
+      e->delay_done = 1;
+      break;
+
+    case IO_ENGINE_TAG_WRITE:
+      e->wr_result = cqe->res;
+      e->wr_done = 1;
+      break;
+
+    case IO_ENGINE_TAG_READ:
+      e->rd_result = cqe->res;
+      e->rd_done = 1;
+      break;
+
+    case IO_ENGINE_TAG_AUX:
+      e->aux_result = cqe->res;
+      e->aux_armed = 0;
+      e->aux_ready = 1;
+      break;
+    }
+
+    head++;
+  }
+
+  __atomic_store_n(e->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Submits whatever is queued and waits for the delay, write and read to finish
+static ssize_t io_engine_wait(io_engine *e) {
+  unsigned remaining;
+
+  while(1) {
+    io_engine_reap(e);
+
+    // Admin input is handled straight away rather than once the token arrives
+    if(e->aux_ready && e->aux_handler != NULL) {
+      e->aux_handler(e->aux_context);
+    }
+
+    remaining = !e->delay_done + !e->wr_done + !e->rd_done;
+
+    if(remaining == 0) {
+      return e->rd_result;
+    }
+
+    // Auxiliary completions count towards min_complete too, so this may take another round
+    if(io_engine_enter(e, remaining) != 0) {
+      return -errno;
+    }
+  }
+}
+
+static void io_engine_prep_rw(struct io_uring_sqe *sqe, int opcode, int fd, const void *buf, size_t len) {
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)buf;
+  sqe->len = len;
+  sqe->off = (__u64)-1;  // Current file position, pipes have none
+}
+
+int io_engine_init(io_engine *e) {
+  struct io_uring_params params;
+
+  memset(e, 0, sizeof(*e));
+  memset(&params, 0, sizeof(params));
+
+  e->ring_fd = io_engine_setup(IO_ENGINE_ENTRIES, &params);
+
+  if(e->ring_fd < 0) {
+    return -1;
+  }
+
+  // Reads and writes at the current position came along with IORING_OP_READ and IORING_OP_WRITE
+  if(!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(e->ring_fd);
+    return -1;
+  }
+
+  e->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  e->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  e->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  e->sq_ring = mmap(NULL, e->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQ_RING);
+  e->cq_ring = mmap(NULL, e->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_CQ_RING);
+  e->sqes = mmap(NULL, e->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQES);
+
+  if(e->sq_ring == MAP_FAILED || e->cq_ring == MAP_FAILED || e->sqes == MAP_FAILED) {
+    io_engine_close(e);
+    return -1;
+  }
+
+  e->sq_head = (unsigned *)((char *)e->sq_ring + params.sq_off.head);
+  e->sq_tail = (unsigned *)((char *)e->sq_ring + params.sq_off.tail);
+  e->sq_array = (unsigned *)((char *)e->sq_ring + params.sq_off.array);
+  e->sq_mask = *(unsigned *)((char *)e->sq_ring + params.sq_off.ring_mask);
+  e->sq_entries = *(unsigned *)((char *)e->sq_ring + params.sq_off.ring_entries);
+  e->sq_local_tail = *e->sq_tail;
+
+  e->cq_head = (unsigned *)((char *)e->cq_ring + params.cq_off.head);
+  e->cq_tail = (unsigned *)((char *)e->cq_ring + params.cq_off.tail);
+  e->cq_mask = *(unsigned *)((char *)e->cq_ring + params.cq_off.ring_mask);
+  e->cqes = (struct io_uring_cqe *)((char *)e->cq_ring + params.cq_off.cqes);
+
+  return 0;
+}
+
+ssize_t io_engine_read(io_engine *e, int fd, void *buf, size_t len) {
+  struct io_uring_sqe *sqe = io_engine_next_sqe(e, IO_ENGINE_TAG_READ);
+
+  if(sqe == NULL) {
+    return -EBUSY;
+  }
+
+  io_engine_prep_rw(sqe, IORING_OP_READ, fd, buf, len);
+
+  e->delay_done = e->wr_done = 1;
+  e->rd_done = 0;
+
+  return io_engine_wait(e);
+}
+
+ssize_t io_engine_write_read(io_engine *e, const struct timespec *delay, int wr_fd, int rd_fd, void *buf, size_t len, ssize_t *wr_result) {
+  struct __kernel_timespec delay_ts;
+  struct io_uring_sqe *sqe;
+  ssize_t rd_result;
+
+  e->delay_done = 1;
+
+  // The timeout always ends in -ETIME, so it is hard linked to keep the write going
+  if(delay != NULL && (delay->tv_sec > 0 || delay->tv_nsec > 0)) {
+    sqe = io_engine_next_sqe(e, IO_ENGINE_TAG_DELAY);
+
+    if(sqe == NULL) {
+      return -EBUSY;
+    }
+
+    delay_ts.tv_sec = delay->tv_sec;
+    delay_ts.tv_nsec = delay->tv_nsec;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)&delay_ts;
+    sqe->len = 1;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    e->delay_done = 0;
+  }
+
+  // The read only starts once the write has succeeded, so they can share the buffer
+  sqe = io_engine_next_sqe(e, IO_ENGINE_TAG_WRITE);
+  io_engine_prep_rw(sqe, IORING_OP_WRITE, wr_fd, buf, len);
+  sqe->flags = IOSQE_IO_LINK;
+
+  sqe = io_engine_next_sqe(e, IO_ENGINE_TAG_READ);
+  io_engine_prep_rw(sqe, IORING_OP_READ, rd_fd, buf, len);
+
+  e->wr_done = e->rd_done = 0;
+
+  rd_result = io_engine_wait(e);
+  *wr_result = e->wr_result;
+
+  return rd_result;
+}
+
+void io_engine_arm_aux(io_engine *e, int fd, void *buf, size_t len) {
+  struct io_uring_sqe *sqe;
+
+  if(e->aux_armed) {
+    return;
+  }
+
+  sqe = io_engine_next_sqe(e, IO_ENGINE_TAG_AUX);
+
+  if(sqe == NULL) {
+    return;
+  }
+
+  // Submitted along with the next token operation
+  io_engine_prep_rw(sqe, IORING_OP_READ, fd, buf, len);
+  e->aux_armed = 1;
+  e->aux_ready = 0;
+}
+
+void io_engine_set_aux_handler(io_engine *e, void (*handler)(void *context), void *context) {
+  e->aux_handler = handler;
+  e->aux_context = context;
+}
+
+int io_engine_aux_result(io_engine *e, ssize_t *rd_len) {
+  if(!e->aux_ready) {
+    return 0;
+  }
+
+  e->aux_ready = 0;
+  *rd_len = e->aux_result;
+
+  return 1;
+}
+
+void io_engine_close(io_engine *e) {
+  if(e->sqes != NULL && e->sqes != MAP_FAILED) {
+    munmap(e->sqes, e->sqes_size);
+  }
+
+  if(e->cq_ring != NULL && e->cq_ring != MAP_FAILED) {
+    munmap(e->cq_ring, e->cq_ring_size);
+  }
+
+  if(e->sq_ring != NULL && e->sq_ring != MAP_FAILED) {
+    munmap(e->sq_ring, e->sq_ring_size);
+  }
+
+  if(e->ring_fd >= 0) {
+    close(e->ring_fd);
+  }
+
+  e->ring_fd = -1;
+  e->sqes = NULL;
+  e->cq_ring = NULL;
+  e->sq_ring = NULL;
+}
@@ -0,0 +1,140 @@
+/** @file io_engine.h
+ *  @brief Function prototypes and structure definitions for the io engine library.
+ *
+ * The io engine library is developed to let a token ring
+ * thread pass the token on and wait for the next one with
+ * a single system call, by submitting the hop delay, the
+ * token write and the next token read to io_uring as one
+ * linked batch. A second, unrelated read (the admin pipe)
+ * can be kept outstanding on the same ring.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __IO_ENGINE_H__
+#define __IO_ENGINE_H__
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define IO_ENGINE_ENTRIES 8
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// A single io_uring instance and the state of the operations on it
+typedef struct io_engine {
+  int ring_fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_local_tail;     // Tail including queued but unpublished entries
+  unsigned to_submit;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  int rd_done, wr_done, delay_done;
+  ssize_t rd_result, wr_result;
+  int aux_armed;              // A read on the auxiliary descriptor is outstanding
+  int aux_ready;              // The auxiliary read has finished, see io_engine_aux_result
+  ssize_t aux_result;
+  void (*aux_handler)(void *context);  // Called as soon as the auxiliary read finishes (NULL to leave it for io_engine_aux_result)
+  void *aux_context;
+  unsigned long enters;       // io_uring_enter calls made
+} io_engine;
+
+/** @brief Sets up an io_uring instance.
+ *
+ *  Fails if the kernel doesn't support io_uring (or the
+ *  features needed for pipes), or it has been disabled,
+ *  in which case the caller should use read and write.
+ *
+ *  @param e The engine to be initialized.
+ *  @return Zero on success, -1 if io_uring is unavailable.
+ */
+int io_engine_init(io_engine *e);
+
+/** @brief Reads from fd, waiting for the read to finish.
+ *
+ *  @param e The engine to use.
+ *  @param fd The descriptor to read.
+ *  @param buf The buffer to read into.
+ *  @param len The number of bytes to read.
+ *  @return The number of bytes read, or a negative errno value.
+ */
+ssize_t io_engine_read(io_engine *e, int fd, void *buf, size_t len);
+
+/** @brief Waits for delay, writes buf to wr_fd, then reads rd_fd into buf.
+ *
+ *  All three steps are submitted together with a single
+ *  system call and run in order. If the write fails the
+ *  read is cancelled (returns -ECANCELED) and buf is left
+ *  as it was.
+ *
+ *  @param e The engine to use.
+ *  @param delay Time to wait before the write, or NULL for none.
+ *  @param wr_fd The descriptor to write.
+ *  @param rd_fd The descriptor to read.
+ *  @param buf The buffer that is written and then read into.
+ *  @param len The number of bytes to write and to read.
+ *  @param wr_result Set to the number of bytes written, or a negative errno value.
+ *  @return The number of bytes read, or a negative errno value.
+ */
+ssize_t io_engine_write_read(io_engine *e, const struct timespec *delay, int wr_fd, int rd_fd, void *buf, size_t len, ssize_t *wr_result);
+
+/** @brief Starts a read on a second descriptor that finishes in the background.
+ *
+ *  The read completes while the engine waits for other
+ *  operations. Only one auxiliary read may be outstanding.
+ *
+ *  @param e The engine to use.
+ *  @param fd The descriptor to read.
+ *  @param buf The buffer to read into, which must stay valid until the read finishes.
+ *  @param len The number of bytes to read.
+ *  @return Void.
+ */
+void io_engine_arm_aux(io_engine *e, int fd, void *buf, size_t len);
+
+/** @brief Sets a function to be called as soon as an auxiliary read finishes.
+ *
+ *  The handler runs on the waiting thread, from inside
+ *  io_engine_read and io_engine_write_read, so the result
+ *  is picked up while the engine is still waiting for the
+ *  token. It may collect the result with io_engine_aux_result
+ *  and arm the next auxiliary read, which is submitted with
+ *  the engine's next system call.
+ *
+ *  @param e The engine to use.
+ *  @param handler The function to call, or NULL for none.
+ *  @param context Passed on to the handler.
+ *  @return Void.
+ */
+void io_engine_set_aux_handler(io_engine *e, void (*handler)(void *context), void *context);
+
+/** @brief Collects the result of a finished auxiliary read.
+ *
+ *  @param e The engine to check.
+ *  @param rd_len Set to the number of bytes read, or a negative errno value.
+ *  @return 1 if the auxiliary read had finished, 0 otherwise.
+ */
+int io_engine_aux_result(io_engine *e, ssize_t *rd_len);
+
+/** @brief Tears down the io_uring instance, cancelling anything outstanding.
+ *
+ *  @param e The engine to be closed.
+ *  @return Void.
+ */
+void io_engine_close(io_engine *e);
+
+#endif // __IO_ENGINE_H__
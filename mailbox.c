@@ -0,0 +1,206 @@
+/** @file mailbox.c
+ *  @brief Function definitions for the mailbox library.
+ *
+ * The mailbox library is developed to hand the messages
+ * delivered to a node to other processes. Every delivery
+ * is copied into a fixed size ring of slots in a shared
+ * memory mapped file, which consumers map and read in
+ * place without any help from the node.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mailbox.h"
+
+int mailbox_create(mailbox *mb, const char *path, int token_id, unsigned slot_count) {
+  int fd;
+
+  mb->shared = NULL;
+
+  if(slot_count == 0 || snprintf(mb->path, sizeof(mb->path), "%s", path) >= (int)sizeof(mb->path)) {
+    return -1;
+  }
+
+  // Consumers of a previous run keep reading the old file
+  unlink(path);
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+  if(fd < 0) {
+    return -1;
+  }
+
+  mb->size = sizeof(mailbox_shared) + (size_t)slot_count * sizeof(mailbox_entry);
+
+  if(ftruncate(fd, mb->size) != 0) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  mb->shared = mmap(NULL, mb->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(mb->shared == MAP_FAILED) {
+    mb->shared = NULL;
+    unlink(path);
+    return -1;
+  }
+
+  // The file starts out zeroed, so every slot is empty
+  mb->slots = (mailbox_entry *)(mb->shared + 1);
+  mb->shared->token_id = token_id;
+  mb->shared->slot_count = slot_count;
+  mb->shared->slot_size = sizeof(mailbox_entry);
+  pthread_mutex_init(&mb->lock, NULL);
+
+  // Consumers check the magic last
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(mb->shared->magic, MAILBOX_MAGIC, MAILBOX_MAGIC_LENGTH);
+
+  return 0;
+}
+
+void mailbox_put(mailbox *mb, const message *msg, int64_t delivered_ns) {
+  mailbox_entry *entry;
+  uint64_t seq;
+
+  pthread_mutex_lock(&mb->lock);
+
+  // A token thread still running past the drain deadline may deliver after the close
+  if(mb->shared == NULL) {
+    pthread_mutex_unlock(&mb->lock);
+    return;
+  }
+
+  seq = mb->shared->head;
+  entry = &mb->slots[seq % mb->shared->slot_count];
+
+  // Readers of the old delivery in this slot see that it has gone before the copy starts
+  __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  entry->delivered_ns = delivered_ns;
+  memcpy(&entry->msg, msg, sizeof(message));
+
+  __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&mb->shared->head, seq + 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&mb->lock);
+}
+
+uint64_t mailbox_written(const mailbox *mb) {
+  return __atomic_load_n(&mb->shared->head, __ATOMIC_ACQUIRE);
+}
+
+void mailbox_close(mailbox *mb) {
+  if(mb->shared == NULL) {
+    return;
+  }
+
+  // The lock is left initialized for any late mailbox_put
+  pthread_mutex_lock(&mb->lock);
+  munmap(mb->shared, mb->size);
+  mb->shared = NULL;
+  pthread_mutex_unlock(&mb->lock);
+}
+
+int mailbox_open(mailbox_reader *r, const char *path) {
+  struct stat file_stat;
+  uint64_t head;
+  int fd = open(path, O_RDONLY);
+
+  r->shared = NULL;
+
+  if(fd < 0) {
+    return -1;
+  }
+
+  if(fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(mailbox_shared)) {
+    close(fd);
+    return -1;
+  }
+
+  r->size = file_stat.st_size;
+  r->shared = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(r->shared == MAP_FAILED) {
+    r->shared = NULL;
+    return -1;
+  }
+
+  // A mailbox written by a different build (or still being set up) is refused
+  if(memcmp(r->shared->magic, MAILBOX_MAGIC, MAILBOX_MAGIC_LENGTH) != 0 || r->shared->slot_size != sizeof(mailbox_entry) ||
+     r->shared->slot_count == 0 || r->size < sizeof(mailbox_shared) + (size_t)r->shared->slot_count * sizeof(mailbox_entry)) {
+    mailbox_reader_close(r);
+    return -1;
+  }
+
+  r->slots = (const mailbox_entry *)(r->shared + 1);
+  r->missed = 0;
+
+  // Start with the oldest delivery still there
+  head = __atomic_load_n(&r->shared->head, __ATOMIC_ACQUIRE);
+  r->cursor = head > r->shared->slot_count ? head - r->shared->slot_count : 0;
+
+  return 0;
+}
+
+const mailbox_entry *mailbox_next(mailbox_reader *r) {
+  const mailbox_entry *entry;
+  uint64_t head, slot_count = r->shared->slot_count;
+
+  while(1) {
+    head = __atomic_load_n(&r->shared->head, __ATOMIC_ACQUIRE);
+
+    if(r->cursor >= head) {
+      return NULL;
+    }
+
+    // Deliveries more than a mailbox behind have been overwritten
+    if(head - r->cursor > slot_count) {
+      r->missed += head - slot_count - r->cursor;
+      r->cursor = head - slot_count;
+    }
+
+    entry = &r->slots[r->cursor % slot_count];
+
+    if(__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) == r->cursor + 1) {
+      return entry;
+    }
+
+    // Overtaken since head was read
+    r->missed++;
+    r->cursor++;
+  }
+}
+
+int mailbox_release(mailbox_reader *r, const mailbox_entry *entry) {
+  uint64_t expected = ++r->cursor;
+
+  // Everything read from the entry happens before seq is checked again
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  if(__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != expected) {
+    r->missed++;
+    return -1;
+  }
+
+  return 0;
+}
+
+void mailbox_reader_close(mailbox_reader *r) {
+  if(r->shared != NULL) {
+    munmap((void *)r->shared, r->size);
+  }
+
+  r->shared = NULL;
+}
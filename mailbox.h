@@ -0,0 +1,150 @@
+/** @file mailbox.h
+ *  @brief Function prototypes and structure definitions for the mailbox library.
+ *
+ * The mailbox library is developed to hand the messages
+ * delivered to a node to other processes. Every delivery
+ * is copied into a fixed size ring of slots in a shared
+ * memory mapped file, which consumers map and read in
+ * place without any help from the node.
+ *
+ * The node never waits for a consumer: once the ring is
+ * full the oldest delivery is overwritten. Every slot
+ * carries the sequence number of the delivery in it, so a
+ * consumer that falls behind (or is overtaken while it is
+ * reading a slot) notices and skips ahead, counting what
+ * it missed.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __MAILBOX_H__
+#define __MAILBOX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "message.h"
+
+#define MAILBOX_MAGIC "TRMBOX01"
+#define MAILBOX_MAGIC_LENGTH 8
+#define MAILBOX_SLOTS_DEFAULT 256
+#define MAILBOX_NAME_LENGTH 256
+
+// A delivered message as it sits in the mailbox
+typedef struct mailbox_entry {
+  uint64_t seq;             // Delivery number plus one, 0 while the slot is being written
+  int64_t delivered_ns;     // CLOCK_MONOTONIC time the message was delivered
+  message msg;
+} mailbox_entry;
+
+// Start of a mailbox file, followed by the slots
+typedef struct mailbox_shared {
+  char magic[MAILBOX_MAGIC_LENGTH];
+  int32_t token_id;         // Node the mailbox belongs to
+  uint32_t slot_count;
+  uint32_t slot_size;       // sizeof(mailbox_entry) of the writer
+  uint32_t reserved;
+  uint64_t head;            // Deliveries written so far
+} mailbox_shared;
+
+// The node's side of a mailbox
+typedef struct mailbox {
+  mailbox_shared *shared;
+  mailbox_entry *slots;
+  size_t size;
+  pthread_mutex_t lock;     // Dual ring nodes deliver from both token threads
+  char path[MAILBOX_NAME_LENGTH];
+} mailbox;
+
+// A consumer's view of a mailbox
+typedef struct mailbox_reader {
+  const mailbox_shared *shared;
+  const mailbox_entry *slots;
+  size_t size;
+  uint64_t cursor;          // Next delivery to be read
+  uint64_t missed;          // Deliveries overwritten before they were read
+} mailbox_reader;
+
+/** @brief Creates (or replaces) a mailbox file and maps it in.
+ *
+ *  An existing file is unlinked first, so consumers still
+ *  reading an old mailbox keep their mapping of it.
+ *
+ *  @param mb The mailbox to be initialized.
+ *  @param path The mailbox file.
+ *  @param token_id The node the mailbox belongs to.
+ *  @param slot_count The number of deliveries kept.
+ *  @return Zero on success, -1 on failure.
+ */
+int mailbox_create(mailbox *mb, const char *path, int token_id, unsigned slot_count);
+
+/** @brief Copies a delivered message into the next slot.
+ *
+ *  Overwrites the oldest delivery when the mailbox is full.
+ *  Never waits for a consumer. Does nothing once the mailbox
+ *  has been closed.
+ *
+ *  @param mb The mailbox to write.
+ *  @param msg The delivered message.
+ *  @param delivered_ns The time the message was delivered.
+ *  @return Void.
+ */
+void mailbox_put(mailbox *mb, const message *msg, int64_t delivered_ns);
+
+/** @brief Returns the number of deliveries written to the mailbox.
+ *
+ *  @param mb The mailbox to check.
+ *  @return The number of deliveries written.
+ */
+uint64_t mailbox_written(const mailbox *mb);
+
+/** @brief Unmaps the mailbox, leaving the file for consumers.
+ *
+ *  Safe to call while another thread may still be putting
+ *  deliveries, which are then dropped.
+ *
+ *  @param mb The mailbox to be closed.
+ *  @return Void.
+ */
+void mailbox_close(mailbox *mb);
+
+/** @brief Maps a mailbox file in for reading.
+ *
+ *  The reader starts at the oldest delivery still in the mailbox.
+ *
+ *  @param r The reader to be initialized.
+ *  @param path The mailbox file.
+ *  @return Zero on success, -1 if the file can't be read or isn't a mailbox.
+ */
+int mailbox_open(mailbox_reader *r, const char *path);
+
+/** @brief Returns the next delivery, in place.
+ *
+ *  Skips ahead (counting the deliveries missed) if the
+ *  reader has fallen more than a mailbox behind. The entry
+ *  may be overwritten while it is being read, so it must
+ *  be handed back with mailbox_release before it is trusted.
+ *
+ *  @param r The reader.
+ *  @return The next delivery, or NULL if there is nothing new.
+ */
+const mailbox_entry *mailbox_next(mailbox_reader *r);
+
+/** @brief Finishes reading the entry returned by mailbox_next.
+ *
+ *  @param r The reader.
+ *  @param entry The entry returned by mailbox_next.
+ *  @return Zero if the entry was intact the whole time, -1 if it was overwritten.
+ */
+int mailbox_release(mailbox_reader *r, const mailbox_entry *entry);
+
+/** @brief Unmaps the mailbox.
+ *
+ *  @param r The reader to be closed.
+ *  @return Void.
+ */
+void mailbox_reader_close(mailbox_reader *r);
+
+#endif // __MAILBOX_H__
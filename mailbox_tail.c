@@ -0,0 +1,86 @@
+/** @file mailbox_tail.c
+ *  @brief Prints the deliveries made to a node as they happen.
+ *
+ * A small consumer of the node mailboxes (see -m). It maps
+ * a mailbox file and prints every delivery read from it,
+ * noting any it fell too far behind to see.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mailbox.h"
+
+#define MAILBOX_TAIL_POLL_NS 10000000
+
+int main(int argc, char *argv[]) {
+  struct timespec poll_interval = {0, MAILBOX_TAIL_POLL_NS};
+  const mailbox_entry *entry;
+  mailbox_reader reader;
+  message msg;
+  int64_t delivered_ns;
+  uint64_t missed = 0;
+  int follow = 0;
+  int opt;
+
+  while((opt = getopt(argc, argv, "f")) != -1) {
+    switch(opt) {
+    case 'f':
+      follow = 1;
+      break;
+
+    default:
+      fprintf(stderr, "Usage: %s [-f] mailbox_file\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  if(optind >= argc) {
+    fprintf(stderr, "Usage: %s [-f] mailbox_file\n", argv[0]);
+    exit(1);
+  }
+
+  if(mailbox_open(&reader, argv[optind]) != 0) {
+    fprintf(stderr, "ERROR: %s isn't a readable mailbox.\n", argv[optind]);
+    exit(1);
+  }
+
+  while(1) {
+    entry = mailbox_next(&reader);
+
+    if(entry == NULL) {
+      if(!follow) {
+	break;
+      }
+
+      nanosleep(&poll_interval, NULL);
+      continue;
+    }
+
+    // The node may overwrite the slot at any time, so keep a copy of what is printed
+    msg = entry->msg;
+    delivered_ns = entry->delivered_ns;
+
+    if(mailbox_release(&reader, entry) != 0) {
+      continue;
+    }
+
+    if(reader.missed != missed) {
+      printf("(%llu deliveries missed)\n", (unsigned long long)(reader.missed - missed));
+      missed = reader.missed;
+    }
+
+    printf("Message %d from endpoint %d, %.3f ms after it was sent: %s", msg.message_id, msg.source_id,
+	   (delivered_ns - msg.created_ns) / 1e6, msg.body);
+    fflush(stdout);
+  }
+
+  mailbox_reader_close(&reader);
+
+  return 0;
+}
@@ -12,11 +12,77 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "message.h"
 
+// Reflected CRC32C (Castagnoli) polynomial, as used by the SSE4.2 crc32 instruction
+#define MESSAGE_FCS_POLY 0x82f63b78
+
 static int msg_count = 0;
 
+static uint32_t message_fcs_table[256];
+static uint32_t (*message_fcs_impl)(uint32_t crc, const unsigned char *data, size_t len);
+
+// Table driven CRC32C, one byte at a time
+static uint32_t message_fcs_table_update(uint32_t crc, const unsigned char *data, size_t len) {
+  while(len-- > 0) {
+    crc = message_fcs_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// CRC32C using the SSE4.2 crc32 instruction, eight bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t message_fcs_sse42_update(uint32_t crc, const unsigned char *data, size_t len) {
+  uint64_t crc64 = crc;
+  uint64_t word;
+
+  while(len >= sizeof(word)) {
+    memcpy(&word, data, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    data += sizeof(word);
+    len -= sizeof(word);
+  }
+
+  crc = (uint32_t)crc64;
+
+  while(len-- > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *data++);
+  }
+
+  return crc;
+}
+#endif
+
+// Builds the lookup table and picks the fastest implementation before main runs
+__attribute__((constructor))
+static void message_fcs_init(void) {
+  uint32_t crc;
+  int byte_iterator, bit_iterator;
+
+  for(byte_iterator=0; byte_iterator<256; byte_iterator++) {
+    crc = byte_iterator;
+
+    for(bit_iterator=0; bit_iterator<8; bit_iterator++) {
+      crc = (crc >> 1) ^ (MESSAGE_FCS_POLY & -(crc & 1));
+    }
+
+    message_fcs_table[byte_iterator] = crc;
+  }
+
+  message_fcs_impl = message_fcs_table_update;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  if(__builtin_cpu_supports("sse4.2")) {
+    message_fcs_impl = message_fcs_sse42_update;
+  }
+#endif
+}
+
 message *message_create(int destination, char *body) {
   // Allocate space for the message to be returned
   message *retval = malloc(sizeof(message));
@@ -33,6 +99,7 @@ message *message_create(int destination, char *body) {
 
     // Copy the body string into the message struct
     strncpy(retval->body, body, MESSAGE_MAX_BODY_LENGTH - 1);
+    retval->body[MESSAGE_MAX_BODY_LENGTH - 1] = '\0';
   }
 
   // Else create a blank message
@@ -42,22 +109,58 @@ message *message_create(int destination, char *body) {
   }
 
   // Assign a message id to the message
-  retval->message_id = msg_count++;
+  retval->message_id = __atomic_fetch_add(&msg_count, 1, __ATOMIC_RELAXED);
+
+  // The source is filled in by the endpoint that sends the message
+  retval->source_id = 0;
+  retval->idle_hops = 0;
+  retval->created_ns = message_clock_ns();
+
+  message_seal(retval);
 
   // Return the newly created message
   return retval;
 }
 
+int message_next_id(void) {
+  return __atomic_load_n(&msg_count, __ATOMIC_RELAXED);
+}
+
+void message_set_next_id(int id) {
+  __atomic_store_n(&msg_count, id, __ATOMIC_RELAXED);
+}
+
 void message_acknowledge(message *msg) {
   // Place a zero in the header to acknowledge reception of a message
   msg->header[0] = '0';
   msg->header[1] = '\0';
+
+  message_seal(msg);
 }
 
 void message_clear(message *msg) {
   // Clear the message
   msg->header[0] = '\0';
   msg->body[0] = '\0';
+
+  message_seal(msg);
+}
+
+uint32_t message_fcs(const message *msg) {
+  // The ids come before idle_hops, everything from created_ns to the end of the body is checked in one pass (skipping padding)
+  size_t id_len = offsetof(message, idle_hops);
+  size_t len = offsetof(message, body) + sizeof(msg->body) - offsetof(message, created_ns);
+  uint32_t crc = message_fcs_impl(~0u, (const unsigned char *)msg, id_len);
+
+  return ~message_fcs_impl(crc, (const unsigned char *)&msg->created_ns, len);
+}
+
+void message_seal(message *msg) {
+  msg->fcs = message_fcs(msg);
+}
+
+int message_check(const message *msg) {
+  return msg->fcs == message_fcs(msg);
 }
 
 // NOTE: Assumes msg supplied == head->msg
@@ -77,6 +180,24 @@ message_queue *message_complete(message *msg, message_queue *head) {
   return head;
 }
 
+void message_completion_init(message_completion *rec, const message *msg, int dest_id, int reporter_id, int status) {
+  rec->message_id = msg->message_id;
+  rec->source_id = msg->source_id;
+  rec->dest_id = dest_id;
+  rec->reporter_id = reporter_id;
+  rec->status = status;
+  rec->created_ns = msg->created_ns;
+  rec->reported_ns = message_clock_ns();
+}
+
+int64_t message_clock_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
 message *message_queue_get_message(message_queue *head) {
   message *retval;
 
@@ -130,6 +251,29 @@ message_queue *message_queue_put_message(message *msg, message_queue *head) {
   }
 }
 
+message_queue *message_queue_remove(message_queue *head, int message_id, int *removed) {
+  message_queue **link = &head;
+  message_queue *temp;
+
+  *removed = 0;
+
+  // Find the link that points at the message
+  while(*link != NULL && (*link)->msg->message_id != message_id) {
+    link = &(*link)->next;
+  }
+
+  if(*link != NULL) {
+    temp = *link;
+    *link = temp->next;
+
+    free(temp->msg);
+    free(temp);
+    *removed = 1;
+  }
+
+  return head;
+}
+
 void message_print(message *msg) {
   printf("Message provided: (%p)\n", msg);
   printf("ID: %d (%p)\n", msg->message_id, &(msg->message_id));
@@ -12,18 +12,43 @@
 #ifndef __MESSAGE_H__
 #define __MESSAGE_H__
 
+#include <stdint.h>
+
 #define MESSAGE_MAX_HEADER_LENGTH 100
 #define MESSAGE_MAX_BODY_LENGTH 1024
 
+// Completion record statuses
+#define MESSAGE_DELIVERED 0  // The destination received the message
+#define MESSAGE_COMPLETED 1  // The sender saw the acknowledgement and dropped the message
+#define MESSAGE_FORWARDED 2  // A bridge handed the message on to the next ring
+#define MESSAGE_PAUSED 3     // The reporter is holding the token for a snapshot
+#define MESSAGE_SNAPSHOTTED 4  // The reporter has written its snapshot section (message_id is -1 on failure)
+#define MESSAGE_UNDELIVERABLE 5  // The sender gave up on the message, its destination has failed
+
 // Message definition
 typedef struct message {
   int message_id;
+  int source_id;  // Endpoint that put the message on the token (0 until sent)
+  int idle_hops;  // Consecutive shutting down nodes with nothing left to send
+  int64_t created_ns;  // CLOCK_MONOTONIC time the message was created
   /* char *header; */
   /* char *body; */
   char header[MESSAGE_MAX_HEADER_LENGTH];
   char body[MESSAGE_MAX_BODY_LENGTH];
+  uint32_t fcs;   // Frame check sequence, CRC32C of every field but idle_hops
 } message;
 
+// Progress report sent by a node to the admin process
+typedef struct message_completion {
+  int message_id;
+  int source_id;       // Endpoint that sent the message on the reporter's ring
+  int dest_id;
+  int reporter_id;     // Endpoint that wrote the record
+  int status;          // MESSAGE_DELIVERED, MESSAGE_COMPLETED or MESSAGE_FORWARDED
+  int64_t created_ns;  // Copied from the message
+  int64_t reported_ns; // CLOCK_MONOTONIC time the record was written
+} message_completion;
+
 // Message queue definition
 typedef struct message_queue {
   message *msg;
@@ -44,6 +69,22 @@ typedef struct message_queue {
  */
 message *message_create(int destination, char *body);
 
+/** @brief Returns the id the next message created will get.
+ *
+ *  @return The next message id.
+ */
+int message_next_id(void);
+
+/** @brief Sets the id the next message created will get.
+ *
+ *  Used to carry on numbering from where a restored
+ *  snapshot left off.
+ *
+ *  @param id The next message id.
+ *  @return Void.
+ */
+void message_set_next_id(int id);
+
 /** @brief Acknowledges a messages reception by modifying the header.
  *
  *  Modifies the header field to represent a received message.
@@ -74,6 +115,56 @@ void message_clear(message *msg);
  */
 message_queue *message_complete(message *msg, message_queue *head);
 
+/** @brief Computes the frame check sequence of the message.
+ *
+ *  Computes the CRC32C of the message using the SSE4.2 crc32
+ *  instruction when the processor has it, or a lookup table
+ *  otherwise. Only the idle hop count is left out, since it
+ *  changes on every hop.
+ *
+ *  @param msg The message to be checked.
+ *  @return The CRC32C of the message.
+ */
+uint32_t message_fcs(const message *msg);
+
+/** @brief Stores the frame check sequence in the message.
+ *
+ *  Must be called whenever any field but idle_hops is changed.
+ *  message_create, message_acknowledge and message_clear
+ *  already do so.
+ *
+ *  @param msg The message to be sealed.
+ *  @return Void.
+ */
+void message_seal(message *msg);
+
+/** @brief Verifies the frame check sequence of the message.
+ *
+ *  @param msg The message to be verified.
+ *  @return Non-zero if the frame check sequence matches, zero if the frame is corrupt.
+ */
+int message_check(const message *msg);
+
+/** @brief Fills in a completion record for the supplied message.
+ *
+ *  @param rec The completion record to be filled in.
+ *  @param msg The message being reported on.
+ *  @param dest_id The destination of the message (the header may already be acknowledged).
+ *  @param reporter_id The token id of the reporting endpoint.
+ *  @param status MESSAGE_DELIVERED, MESSAGE_COMPLETED or MESSAGE_FORWARDED.
+ *  @return Void.
+ */
+void message_completion_init(message_completion *rec, const message *msg, int dest_id, int reporter_id, int status);
+
+/** @brief Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ *
+ *  The clock is shared by every process, so times taken in
+ *  different nodes can be compared.
+ *
+ *  @return The current time in nanoseconds.
+ */
+int64_t message_clock_ns(void);
+
 /** @brief Get the oldest message on the message queue supplied.
  *
  *  Returns a message pointer for the oldest message on the
@@ -98,6 +189,18 @@ message *message_queue_get_message(message_queue *head);
  */
 message_queue *message_queue_put_message(message *msg, message_queue *head);
 
+/** @brief Removes the message with the supplied id from the message queue.
+ *
+ *  Frees the removed message and its queue element. The
+ *  queue is left as it was if no message has the id.
+ *
+ *  @param head The message queue to search.
+ *  @param message_id The id of the message to be removed.
+ *  @param removed Set to 1 if a message was removed, 0 otherwise.
+ *  @return A pointer to the modified message queue.
+ */
+message_queue *message_queue_remove(message_queue *head, int message_id, int *removed);
+
 /** @brief Print the message provided in a descriptive manner.
  *
  *  Prints out a useful string-based representation of the
@@ -0,0 +1,1332 @@
+/** @file node.c
+ *  @brief Function definitions for the node library.
+ *
+ * The node library is developed to hold the behaviour
+ * of a token ring node process: the token ring thread(s)
+ * that pass the token and the admin thread that receives
+ * messages from the admin process.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "node.h"
+
+#define WAIT_STATS_INTERVAL 1000
+#define NODE_SHUTDOWN_POLL_NS 10000000
+#define NODE_RETRANSMIT_MIN_MS 1000    // Shortest time a dual ring frame is given to come back
+#define NODE_RETRANSMIT_REVOLUTIONS 4  // Revolutions a dual ring frame is given to come back (a wrapped ring is twice as long)
+
+static void *node_token_ring_passer(void *port_descriptor);
+static void *node_admin_thread_handler(void *node_descriptor);
+
+// Counts a frame that failed its frame check and turns it back into a blank token
+static void node_port_drop_corrupt(node_port *port, message *msg) {
+  printf("%s: Frame check failed, dropping frame.\n", port->name);
+
+  port->corrupted++;
+  message_clear(msg);
+}
+
+// Tells the admin process how far a message has got
+static void node_port_report(node_port *port, message *msg, int dest_id, int status) {
+  message_completion rec;
+
+  if(port->owner->completion_wr_pipe < 0) {
+    return;
+  }
+
+  message_completion_init(&rec, msg, dest_id, port->owner->token_id, status);
+
+  // Records are smaller than PIPE_BUF, so writes from every node arrive whole
+  port->syscalls++;
+
+  if(write(port->owner->completion_wr_pipe, &rec, sizeof(rec)) != sizeof(rec)) {
+    port->unreported++;
+  }
+}
+
+// Tells the admin process the node has reached a step of a snapshot
+static void node_report_control(node *n, int status, int result) {
+  message_completion rec;
+
+  if(n->completion_wr_pipe < 0) {
+    return;
+  }
+
+  memset(&rec, 0, sizeof(rec));
+  rec.message_id = result;
+  rec.reporter_id = n->token_id;
+  rec.status = status;
+  rec.reported_ns = message_clock_ns();
+
+  write(n->completion_wr_pipe, &rec, sizeof(rec));
+}
+
+// Holds on to the token just read while a snapshot is being taken
+static void node_port_hold(node_port *port, message *msg) {
+  node *owner = port->owner;
+
+  if(!owner->pausing) {
+    return;
+  }
+
+  pthread_mutex_lock(&owner->pause_lock);
+
+  if(owner->pausing) {
+    printf("%s: Holding the token for a snapshot.\n", port->name);
+
+    owner->held_token = msg;
+    node_report_control(owner, MESSAGE_PAUSED, 0);
+
+    while(owner->pausing) {
+      pthread_cond_wait(&owner->resumed, &owner->pause_lock);
+    }
+
+    owner->held_token = NULL;
+  }
+
+  pthread_mutex_unlock(&owner->pause_lock);
+}
+
+// Sets up a single port of the node
+static void node_port_init(node *n, node_port *port, int ring_id, int ring_size, int token_pipe[2]) {
+  port->owner = n;
+  port->peer = NULL;
+  port->ring_id = ring_id;
+  port->ring_size = ring_size;
+  port->alive = 1;
+  port->token_rd_pipe = token_pipe[PIPE_READ_INDEX];
+  port->token_wr_pipe = token_pipe[PIPE_WRITE_INDEX];
+  port->forward_ring_lo = 0;
+  port->forward_ring_hi = -1;
+  port->msg_queue = NULL;
+  port->queue_depth = 0;
+  port->queue_high_water = 0;
+  port->hops = 0;
+  port->sent = 0;
+  port->received = 0;
+  port->forwarded = 0;
+  port->corrupted = 0;
+  port->unreported = 0;
+  port->drained = 0;
+  port->quiet = 0;
+  port->engine = NULL;
+  port->sent_flag = 0;
+  port->sent_id = 0;
+  port->sent_dest = 0;
+  port->sent_ns = 0;
+  port->in_flight_count = 0;
+  port->restore_frame = NULL;
+  port->syscalls = 0;
+  memset(&port->wait_state, 0, sizeof(port->wait_state));
+#ifdef TOKEN_RING_PROFILE
+  memset(&port->profile, 0, sizeof(port->profile));
+  memset(&port->profile_published, 0, sizeof(port->profile_published));
+#endif
+  pthread_mutex_init(&port->queue_lock, NULL);
+  pthread_cond_init(&port->queue_not_full, NULL);
+
+  snprintf(port->name, NODE_NAME_LENGTH, "Endpoint %d", n->token_id);
+}
+
+// Makes the two ports of a bridge forward frames for the far side to each other
+static void node_port_bridge(node_port *port, node_port *peer, int num_rings) {
+  port->peer = peer;
+
+  // Rings are chained in order, so the far side is everything past the peer's ring
+  if(peer->ring_id > port->ring_id) {
+    port->forward_ring_lo = peer->ring_id;
+    port->forward_ring_hi = num_rings - 1;
+  }
+  else {
+    port->forward_ring_lo = 0;
+    port->forward_ring_hi = peer->ring_id;
+  }
+
+  snprintf(port->name, NODE_NAME_LENGTH, "Endpoint %d [ring %d]", port->owner->token_id, port->ring_id);
+}
+
+// Returns non-zero if the frame destination lives on the far side of this port's bridge
+static int node_port_should_forward(node_port *port, int msg_dest) {
+  node *owner = port->owner;
+  int dest_ring;
+
+  if(port->peer == NULL || msg_dest <= 0 || msg_dest >= owner->route_table_length) {
+    return 0;
+  }
+
+  dest_ring = owner->route_table[msg_dest];
+
+  return dest_ring >= port->forward_ring_lo && dest_ring <= port->forward_ring_hi;
+}
+
+// Pairs the primary and secondary ring ports of a dual ring node
+static void node_port_counter_rotate(node_port *port, node_port *peer, const char *role) {
+  port->peer = peer;
+
+  snprintf(port->name, NODE_NAME_LENGTH, "Endpoint %d [%s]", port->owner->token_id, role);
+}
+
+// Appends a copy of the message to the port's queue, returns -1 if the queue is full
+static int node_port_enqueue(node_port *port, message *msg, int mode) {
+  int capacity = port->owner->opts->queue_depth;
+
+  pthread_mutex_lock(&port->queue_lock);
+
+  // Stop reading the admin pipe until there is room, which pushes back on the admin process
+  while(mode == NODE_ENQUEUE_WAIT && capacity > 0 && port->queue_depth >= capacity && port->alive && !port->owner->draining) {
+    pthread_cond_wait(&port->queue_not_full, &port->queue_lock);
+  }
+
+  // A draining node doesn't take new messages from the admin process, and a cut ring can't send them
+  if(mode == NODE_ENQUEUE_WAIT && (port->owner->draining || !port->alive)) {
+    pthread_mutex_unlock(&port->queue_lock);
+    return -1;
+  }
+
+  if(mode == NODE_ENQUEUE_TRY && capacity > 0 && port->queue_depth >= capacity) {
+    pthread_mutex_unlock(&port->queue_lock);
+    return -1;
+  }
+
+  port->msg_queue = message_queue_put_message(msg, port->msg_queue);
+  port->queue_depth++;
+
+  if(port->queue_depth > port->queue_high_water) {
+    port->queue_high_water = port->queue_depth;
+  }
+
+  pthread_mutex_unlock(&port->queue_lock);
+
+  return 0;
+}
+
+// Removes the acknowledged message at the head of the port's queue
+static void node_port_dequeue(node_port *port) {
+  pthread_mutex_lock(&port->queue_lock);
+
+  port->msg_queue = message_complete(port->msg_queue->msg, port->msg_queue);
+  port->queue_depth--;
+
+  pthread_cond_signal(&port->queue_not_full);
+  pthread_mutex_unlock(&port->queue_lock);
+}
+
+// Idle hops in a row that show every port on the ring has nothing left to send
+static int node_port_drain_hops(node_port *port) {
+  // A dual ring may have wrapped anywhere, and the wrapped loop passes each live node on both ports
+  if(port->owner->dual_ring && port->ring_size > 1) {
+    return 2 * (port->ring_size - 1);
+  }
+
+  return port->ring_size;
+}
+
+// Returns non-zero once the peer's ring can't send anything more across the bridge
+static int node_port_peer_quiet(node_port *port) {
+  node_port *peer = port->peer;
+  int quiet;
+
+  pthread_mutex_lock(&peer->queue_lock);
+  quiet = peer->drained || !peer->alive || (peer->quiet && peer->queue_depth == 0);
+  pthread_mutex_unlock(&peer->queue_lock);
+
+  return quiet;
+}
+
+// Returns non-zero if the frame is the one the port has out on the ring
+static int node_port_owns(node_port *port, message *msg) {
+  return port->sent_flag && msg->source_id == port->owner->token_id && msg->message_id == port->sent_id;
+}
+
+// Returns non-zero if the port's frame should be given up on when a blank token arrives
+static int node_port_sent_lost(node_port *port, message *msg) {
+  int64_t timeout_ns = (int64_t)NODE_RETRANSMIT_REVOLUTIONS * port->ring_size * port->owner->opts->hop_delay_us * 1000;
+
+  if(!port->sent_flag) {
+    return 0;
+  }
+
+  // A single token ring only has the one token, so the frame that was sent never came back
+  if(!port->owner->dual_ring) {
+    return 1;
+  }
+
+  // The frame came back cleared, it was dropped on the way around
+  if(msg->source_id == port->owner->token_id && msg->message_id == port->sent_id) {
+    return 1;
+  }
+
+  // The frame vanished with a failed node, the other ring's token may be passing through in the meantime
+  if(timeout_ns < (int64_t)NODE_RETRANSMIT_MIN_MS * 1000000) {
+    timeout_ns = (int64_t)NODE_RETRANSMIT_MIN_MS * 1000000;
+  }
+
+  return message_clock_ns() - port->sent_ns > timeout_ns;
+}
+
+// Removes an acknowledged message from anywhere in the port's queue (slotted rings only)
+static void node_port_remove(node_port *port, int message_id) {
+  int removed;
+
+  pthread_mutex_lock(&port->queue_lock);
+
+  port->msg_queue = message_queue_remove(port->msg_queue, message_id, &removed);
+  port->queue_depth -= removed;
+
+  pthread_cond_signal(&port->queue_not_full);
+  pthread_mutex_unlock(&port->queue_lock);
+}
+
+// Returns the index of the message in the port's in flight list, or -1 if it isn't out on a slot
+static int node_port_in_flight(node_port *port, int message_id) {
+  int slot_iterator;
+
+  for(slot_iterator=0; slot_iterator<port->in_flight_count; slot_iterator++) {
+    if(port->in_flight_id[slot_iterator] == message_id) {
+      return slot_iterator;
+    }
+  }
+
+  return -1;
+}
+
+// Drops an entry from the port's in flight list, its message stays queued until acknowledged
+static void node_port_in_flight_drop(node_port *port, int in_flight) {
+  port->in_flight_count--;
+  port->in_flight_id[in_flight] = port->in_flight_id[port->in_flight_count];
+  port->in_flight_dest[in_flight] = port->in_flight_dest[port->in_flight_count];
+  port->in_flight_hop[in_flight] = port->in_flight_hop[port->in_flight_count];
+}
+
+// Forgets slots that missed their return, lost with a failed node or no longer recognizable as this node's
+static void node_port_age_in_flight(node_port *port) {
+  unsigned long revolution = port->owner->opts->slots;
+  int in_flight = 0;
+
+  // Every slot passes this node once per revolution of all slots
+  while(in_flight < port->in_flight_count) {
+    if(port->hops - port->in_flight_hop[in_flight] > revolution) {
+      printf("%s: Slot carrying message %d never came back, retrying on a later slot.\n", port->name, port->in_flight_id[in_flight]);
+      node_port_in_flight_drop(port, in_flight);
+    }
+    else {
+      in_flight++;
+    }
+  }
+}
+
+// Handles a single slot of a slotted ring, leaving whatever is to be passed on in msg
+static void node_port_process_slot(node_port *port, message *msg) {
+  int token_id = port->owner->token_id;
+  int msg_dest = strtol(msg->header, NULL, 10);
+  int in_flight;
+  message_queue *candidate;
+  int intact;
+  PROFILE_DECLARE(phase_start);
+
+  node_port_age_in_flight(port);
+  in_flight = msg->source_id == token_id ? node_port_in_flight(port, msg->message_id) : -1;
+
+  // Handle message for this node (including one it sent itself, which is freed on its next visit)
+  if(msg->header[0] != '\0' && msg_dest == token_id) {
+    PROFILE_BEGIN(phase_start);
+    intact = message_check(msg);
+    PROFILE_END(&port->profile, PROFILE_PHASE_PARSE, phase_start);
+
+    // The source sees the slot come back unacknowledged and sends the message again
+    if(!intact) {
+      node_port_drop_corrupt(port, msg);
+      return;
+    }
+
+    printf("%s: Received message: %s", port->name, msg->body);
+
+    if(port->owner->deliveries != NULL) {
+      mailbox_put(port->owner->deliveries, msg, message_clock_ns());
+    }
+
+    message_acknowledge(msg);
+    port->received++;
+
+    node_port_report(port, msg, token_id, MESSAGE_DELIVERED);
+    return;
+  }
+
+  // Handle slot this port filled coming back around, the source always frees it
+  if(in_flight >= 0) {
+    if(msg_dest == 0 && msg->header[0] == '0' && message_check(msg)) {
+      printf("%s: Message successfully sent and acknowledged.\n", port->name);
+
+      PROFILE_BEGIN(phase_start);
+      node_port_remove(port, msg->message_id);
+      PROFILE_END(&port->profile, PROFILE_PHASE_QUEUE, phase_start);
+      port->sent++;
+
+      node_port_report(port, msg, port->in_flight_dest[in_flight], MESSAGE_COMPLETED);
+    }
+    else {
+      printf("%s: Message failed to be received, retrying on a later slot.\n", port->name);
+    }
+
+    node_port_in_flight_drop(port, in_flight);
+  }
+
+  // Anything else still carrying this node's id is left over and freed too, as is a slot that lost its source
+  if(msg->source_id == token_id || (msg->header[0] != '\0' && msg->source_id < ENDPOINT_BASE_ADDR)) {
+    // Passed on empty, so the next node gets a chance to use it
+    msg->source_id = 0;
+    message_clear(msg);
+    printf("%s: Freeing slot.\n", port->name);
+    return;
+  }
+
+  // Not intended destination, nor did this node send anything
+  if(msg->header[0] != '\0') {
+    printf("%s: Passing slot ahead...\n", port->name);
+    return;
+  }
+
+  PROFILE_BEGIN(phase_start);
+  pthread_mutex_lock(&port->queue_lock);
+
+  // Fill the empty slot with the oldest message not already out on another slot
+  candidate = port->msg_queue;
+
+  while(candidate != NULL && node_port_in_flight(port, candidate->msg->message_id) >= 0) {
+    candidate = candidate->next;
+  }
+
+  if(candidate != NULL && port->in_flight_count < NODE_MAX_SLOTS) {
+    printf("%s: Putting new message in empty slot.\n", port->name);
+
+    // Copy it from the message queue, it stays queued until acknowledged
+    memcpy(msg, candidate->msg, sizeof(message));
+    msg->source_id = token_id;
+    message_seal(msg);
+    port->in_flight_id[port->in_flight_count] = msg->message_id;
+    port->in_flight_dest[port->in_flight_count] = strtol(msg->header, NULL, 10);
+    port->in_flight_hop[port->in_flight_count] = port->hops;
+    port->in_flight_count++;
+  }
+  else {
+    printf("%s: Empty slot found.\n", port->name);
+  }
+
+  pthread_mutex_unlock(&port->queue_lock);
+  PROFILE_END(&port->profile, PROFILE_PHASE_QUEUE, phase_start);
+}
+
+// Picks the port a message for the supplied destination should be sent from
+static node_port *node_select_port(node *n, int msg_dest) {
+  node_port *primary = &n->ports[0];
+  node_port *secondary = &n->ports[1];
+  int clockwise_hops, counter_hops;
+
+  if(n->port_count < 2) {
+    return primary;
+  }
+
+  // A port whose ring has been cut can't send anything
+  if(!secondary->alive) {
+    return primary;
+  }
+
+  if(!primary->alive) {
+    return secondary;
+  }
+
+  // Bridges send from the port facing the destination's ring
+  if(!n->dual_ring) {
+    return node_port_should_forward(primary, msg_dest) ? secondary : primary;
+  }
+
+  // Dual rings take the direction with the fewest hops to the destination
+  clockwise_hops = ((msg_dest - n->token_id) % primary->ring_size + primary->ring_size) % primary->ring_size;
+  counter_hops = (primary->ring_size - clockwise_hops) % primary->ring_size;
+
+  return counter_hops < clockwise_hops ? secondary : primary;
+}
+
+// Hands the messages of a port whose ring was cut over to its peer
+static void node_port_abandon(node_port *port) {
+  message_queue *orphans = NULL;
+
+  // Taken together with the queue, so nothing can be queued here after the hand over
+  pthread_mutex_lock(&port->queue_lock);
+  port->alive = 0;
+
+  // The peer sends the message out on this ring again, so a copy still going around is stale
+  port->sent_flag = 0;
+
+  if(port->peer != NULL && port->peer->alive) {
+    orphans = port->msg_queue;
+    port->msg_queue = NULL;
+    port->queue_depth = 0;
+  }
+
+  // Wake the admin thread if it is waiting for room on this port, it picks another port
+  pthread_cond_broadcast(&port->queue_not_full);
+  pthread_mutex_unlock(&port->queue_lock);
+
+  // Requeue in order on the surviving port
+  while(orphans != NULL) {
+    node_port_enqueue(port->peer, orphans->msg, NODE_ENQUEUE_FORCE);
+    orphans = message_complete(orphans->msg, orphans);
+  }
+}
+
+// Writes the token to the next node, wrapping onto the peer ring if the next node has failed
+static void node_port_write(node_port *port, message *msg) {
+  while(1) {
+    port->syscalls++;
+
+    if(write(port->token_wr_pipe, msg, sizeof(message)) >= 0) {
+      return;
+    }
+
+    if(errno == EINTR) {
+      continue;
+    }
+
+    // The next node has already finished shutting down
+    if(errno == EPIPE && port->owner->draining) {
+      return;
+    }
+
+    // In dual ring mode, loop the primary back over the secondary (and vice versa)
+    if(errno == EPIPE && port->owner->dual_ring && port->token_wr_pipe != port->peer->token_wr_pipe) {
+      printf("%s: Next endpoint has failed, wrapping onto the other ring.\n", port->name);
+      port->token_wr_pipe = port->peer->token_wr_pipe;
+      continue;
+    }
+
+    printf("%s: Unable to pass the token to the next endpoint.\n", port->name);
+    return;
+  }
+}
+
+// System calls made on behalf of the port's token thread
+static unsigned long node_port_syscalls(node_port *port) {
+  return port->syscalls + port->wait_state.syscalls + (port->engine != NULL ? port->engine->enters : 0);
+}
+
+// Reads the first token from the previous node
+static ssize_t node_port_read(node_port *port, message *msg) {
+  if(port->engine != NULL) {
+    return io_engine_read(port->engine, port->token_rd_pipe, msg, sizeof(message));
+  }
+
+  return token_wait_read(&port->wait_state, port->token_rd_pipe, msg, sizeof(message));
+}
+
+// Holds the token for the hop delay, passes it to the next node and waits for the next token
+static ssize_t node_port_pass(node_port *port, message *msg, const struct timespec *hop_delay) {
+  ssize_t wr_len = -1;
+  ssize_t rd_len;
+  PROFILE_DECLARE(phase_start);
+
+  // One system call for the delay, the write and the read
+  if(port->engine != NULL) {
+    PROFILE_BEGIN(phase_start);
+    rd_len = io_engine_write_read(port->engine, hop_delay, port->token_wr_pipe, port->token_rd_pipe, msg, sizeof(message), &wr_len);
+
+    // The read is cancelled when the write fails, let node_port_write deal with the failure
+    if(wr_len != sizeof(message)) {
+      node_port_write(port, msg);
+      rd_len = io_engine_read(port->engine, port->token_rd_pipe, msg, sizeof(message));
+    }
+
+    PROFILE_END(&port->profile, PROFILE_PHASE_READ, phase_start);
+
+    return rd_len;
+  }
+
+  if(hop_delay->tv_sec > 0 || hop_delay->tv_nsec > 0) {
+    PROFILE_BEGIN(phase_start);
+    port->syscalls++;
+    nanosleep(hop_delay, NULL);
+    PROFILE_END(&port->profile, PROFILE_PHASE_PACING, phase_start);
+  }
+
+  PROFILE_BEGIN(phase_start);
+  node_port_write(port, msg);
+  PROFILE_END(&port->profile, PROFILE_PHASE_WRITE, phase_start);
+
+  PROFILE_BEGIN(phase_start);
+  rd_len = token_wait_read(&port->wait_state, port->token_rd_pipe, msg, sizeof(message));
+  PROFILE_END(&port->profile, PROFILE_PHASE_READ, phase_start);
+
+  return rd_len;
+}
+
+// Queues the admin message read by the io_uring engine and reads the next one once there is room
+static void node_port_poll_admin(node_port *port) {
+  node *owner = port->owner;
+  ssize_t rd_len;
+
+  if(!owner->admin_in_engine) {
+    return;
+  }
+
+  if(io_engine_aux_result(port->engine, &rd_len)) {
+    // The admin process has closed its end
+    if(rd_len <= 0) {
+      owner->admin_in_engine = 0;
+      return;
+    }
+
+    owner->admin_pending = 1;
+  }
+
+  // A draining node doesn't take new messages from the admin process
+  if(owner->admin_pending && owner->draining) {
+    owner->admin_refused++;
+    owner->admin_pending = 0;
+  }
+
+  // Leaving the admin pipe unread while the queue is full pushes back on the admin process
+  if(owner->admin_pending && node_port_enqueue(port, owner->admin_buffer, NODE_ENQUEUE_TRY) == 0) {
+    owner->admin_pending = 0;
+  }
+
+  // Submitted along with the next token operation
+  if(!owner->admin_pending) {
+    io_engine_arm_aux(port->engine, owner->admin_rd_pipe, owner->admin_buffer, sizeof(message));
+  }
+}
+
+// Queues admin input as soon as the engine reads it, even while the token is elsewhere on the ring
+static void node_port_admin_ready(void *port_descriptor) {
+  node_port_poll_admin(port_descriptor);
+}
+
+node *node_create(endpoint *endp, const simulator_options *opts, const int *ring_sizes, int completion_wr_pipe, int *route_table, int route_table_length) {
+  node *retval = malloc(sizeof(node));
+
+  if(retval == NULL) {
+    return NULL;
+  }
+
+  retval->token_id = endp->token_id;
+  retval->pid = endp->pid;
+  retval->admin_rd_pipe = endp->admin_pipe[PIPE_READ_INDEX];
+  retval->completion_wr_pipe = completion_wr_pipe;
+  retval->admin_in_engine = 0;
+  retval->admin_buffer = NULL;
+  retval->admin_pending = 0;
+  retval->admin_syscalls = 0;
+  retval->admin_refused = 0;
+  retval->dual_ring = opts->dual_ring;
+  retval->draining = 0;
+  retval->pausing = 0;
+  retval->held_token = NULL;
+  retval->deliveries = NULL;
+  pthread_mutex_init(&retval->pause_lock, NULL);
+  pthread_cond_init(&retval->resumed, NULL);
+  retval->route_table = route_table;
+  retval->route_table_length = route_table_length;
+  retval->opts = opts;
+
+  // Every node is attached to its own ring
+  retval->port_count = 1;
+  node_port_init(retval, &retval->ports[0], endp->ring_id, ring_sizes[endp->ring_id], endp->token_pipe);
+
+  // Bridges and dual ring nodes are also attached to a second ring
+  if(endp->alt_ring_id >= 0) {
+    retval->port_count = 2;
+    node_port_init(retval, &retval->ports[1], endp->alt_ring_id, ring_sizes[endp->alt_ring_id], endp->alt_token_pipe);
+
+    if(opts->dual_ring) {
+      node_port_counter_rotate(&retval->ports[0], &retval->ports[1], "primary");
+      node_port_counter_rotate(&retval->ports[1], &retval->ports[0], "secondary");
+    }
+    else {
+      node_port_bridge(&retval->ports[0], &retval->ports[1], opts->rings);
+      node_port_bridge(&retval->ports[1], &retval->ports[0], opts->rings);
+    }
+  }
+
+  return retval;
+}
+
+int node_start(node *n) {
+  char mailbox_path[MAILBOX_NAME_LENGTH];
+  pthread_attr_t thread_attr;
+  node_port *port;
+  int port_iterator;
+
+  // Slim nodes reserve a fraction of the default 8 MiB per thread
+  pthread_attr_init(&thread_attr);
+
+  if(n->opts->slim) {
+    pthread_attr_setstacksize(&thread_attr, NODE_SLIM_STACK_SIZE < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : NODE_SLIM_STACK_SIZE);
+  }
+
+  // Deliveries are only copied out if someone asked for them
+  if(n->opts->mailbox_dir != NULL) {
+    snprintf(mailbox_path, sizeof(mailbox_path), "%s/mailbox.%d", n->opts->mailbox_dir, n->token_id);
+    n->deliveries = malloc(sizeof(mailbox));
+
+    if(mailbox_create(n->deliveries, mailbox_path, n->token_id, MAILBOX_SLOTS_DEFAULT) != 0) {
+      printf("Endpoint %d: Unable to create %s, deliveries won't be copied out.\n", n->token_id, mailbox_path);
+      free(n->deliveries);
+      n->deliveries = NULL;
+    }
+  }
+
+  for(port_iterator=0; port_iterator<n->port_count && n->opts->io_uring; port_iterator++) {
+    port = &n->ports[port_iterator];
+    port->engine = malloc(sizeof(io_engine));
+
+    if(io_engine_init(port->engine) != 0) {
+      printf("%s: io_uring is unavailable, falling back to read and write.\n", port->name);
+      free(port->engine);
+      port->engine = NULL;
+    }
+  }
+
+  // With a single ring there's no question of which token thread should feed the queue
+  if(n->port_count == 1 && n->ports[0].engine != NULL) {
+    n->admin_in_engine = 1;
+    n->admin_buffer = malloc(sizeof(message));
+    io_engine_set_aux_handler(n->ports[0].engine, node_port_admin_ready, &n->ports[0]);
+  }
+  else if(pthread_create(&n->admin_thread, &thread_attr, node_admin_thread_handler, n) != 0) {
+    pthread_attr_destroy(&thread_attr);
+    return -1;
+  }
+
+  for(port_iterator=0; port_iterator<n->port_count; port_iterator++) {
+    if(pthread_create(&n->ports[port_iterator].token_thread, &thread_attr, node_token_ring_passer, &n->ports[port_iterator]) != 0) {
+      pthread_attr_destroy(&thread_attr);
+      return -1;
+    }
+  }
+
+  pthread_attr_destroy(&thread_attr);
+
+  return 0;
+}
+
+int node_shutdown(node *n, int deadline_ms) {
+  struct timespec poll_interval = {0, NODE_SHUTDOWN_POLL_NS};
+  long waited_ns = 0;
+  int port_iterator;
+  int finished;
+  int abandoned = 0;
+
+  printf("Endpoint %d: Shutting down, draining queues...\n", n->token_id);
+
+  // Token threads count idle nodes on the token from here on, the admin thread stops queueing
+  n->draining = 1;
+
+  // Wake the admin thread if it is waiting for room
+  for(port_iterator=0; port_iterator<n->port_count; port_iterator++) {
+    pthread_mutex_lock(&n->ports[port_iterator].queue_lock);
+    pthread_cond_broadcast(&n->ports[port_iterator].queue_not_full);
+    pthread_mutex_unlock(&n->ports[port_iterator].queue_lock);
+  }
+
+  while(1) {
+    finished = 1;
+
+    for(port_iterator=0; port_iterator<n->port_count; port_iterator++) {
+      if(n->ports[port_iterator].alive && !n->ports[port_iterator].drained) {
+	finished = 0;
+      }
+    }
+
+    if(finished || waited_ns >= deadline_ms * 1000000L) {
+      break;
+    }
+
+    nanosleep(&poll_interval, NULL);
+    waited_ns += NODE_SHUTDOWN_POLL_NS;
+  }
+
+  // Whatever is left is given up on
+  for(port_iterator=0; port_iterator<n->port_count; port_iterator++) {
+    pthread_mutex_lock(&n->ports[port_iterator].queue_lock);
+
+    if(n->ports[port_iterator].queue_depth > 0) {
+      printf("%s: Deadline passed, abandoning %d queued messages.\n", n->ports[port_iterator].name, n->ports[port_iterator].queue_depth);
+      abandoned += n->ports[port_iterator].queue_depth;
+    }
+
+    pthread_mutex_unlock(&n->ports[port_iterator].queue_lock);
+  }
+
+  if(n->admin_refused > 0) {
+    printf("Endpoint %d: Refused %lu messages from the admin process while draining.\n", n->token_id, n->admin_refused);
+  }
+
+  node_print_stats(n);
+
+  // Consumers keep reading the file after the node has gone
+  if(n->deliveries != NULL) {
+    mailbox_close(n->deliveries);
+  }
+
+  return abandoned;
+}
+
+void node_pause(node *n) {
+  pthread_mutex_lock(&n->pause_lock);
+  n->pausing = 1;
+  pthread_mutex_unlock(&n->pause_lock);
+}
+
+int node_snapshot(node *n, const char *path) {
+  node_port *port = &n->ports[0];
+  snapshot_node *section;
+  message_queue *iterator;
+  size_t length = sizeof(snapshot_node);
+  char *next;
+  int retval;
+
+  pthread_mutex_lock(&n->pause_lock);
+  pthread_mutex_lock(&port->queue_lock);
+
+  for(iterator=port->msg_queue; iterator!=NULL; iterator=iterator->next) {
+    length += snapshot_message_size(iterator->msg);
+  }
+
+  if(n->held_token != NULL) {
+    length += snapshot_message_size(n->held_token);
+  }
+
+  section = calloc(1, length);
+  section->length = length;
+  section->token_id = n->token_id;
+  section->queue_length = port->queue_depth;
+  section->holds_token = n->held_token != NULL;
+  section->sent_flag = port->sent_flag;
+  section->sent_id = port->sent_id;
+  section->sent_dest = port->sent_dest;
+  section->queue_high_water = port->queue_high_water;
+  section->hops = port->hops;
+  section->sent = port->sent;
+  section->received = port->received;
+  section->forwarded = port->forwarded;
+  section->corrupted = port->corrupted;
+
+  // Queued messages, then the token
+  next = (char *)(section + 1);
+
+  for(iterator=port->msg_queue; iterator!=NULL; iterator=iterator->next) {
+    next = snapshot_put_message(next, iterator->msg);
+  }
+
+  if(n->held_token != NULL) {
+    snapshot_put_message(next, n->held_token);
+  }
+
+  pthread_mutex_unlock(&port->queue_lock);
+
+  retval = snapshot_append(path, section);
+
+  printf("Endpoint %d: Snapshot %s, %d queued messages%s.\n", n->token_id, retval == 0 ? "saved" : "failed",
+	 section->queue_length, n->held_token != NULL ? " and the token" : "");
+
+  free(section);
+
+  // Let the token go again
+  n->pausing = 0;
+  pthread_cond_broadcast(&n->resumed);
+  pthread_mutex_unlock(&n->pause_lock);
+
+  node_report_control(n, MESSAGE_SNAPSHOTTED, retval);
+
+  return retval;
+}
+
+void node_resume(node *n) {
+  pthread_mutex_lock(&n->pause_lock);
+  n->pausing = 0;
+  pthread_cond_broadcast(&n->resumed);
+  pthread_mutex_unlock(&n->pause_lock);
+}
+
+int node_restore(node *n, const snapshot *snap) {
+  const snapshot_node *section = snapshot_find_node(snap, n->token_id);
+  node_port *port = &n->ports[0];
+  const char *next, *end;
+  message msg;
+  int msg_iterator;
+
+  if(section == NULL) {
+    return -1;
+  }
+
+  next = (const char *)(section + 1);
+  end = (const char *)section + section->length;
+
+  for(msg_iterator=0; msg_iterator<section->queue_length; msg_iterator++) {
+    next = snapshot_get_message(next, end, &msg);
+
+    if(next == NULL) {
+      return -1;
+    }
+
+    node_port_enqueue(port, &msg, NODE_ENQUEUE_FORCE);
+  }
+
+  if(section->holds_token) {
+    port->restore_frame = malloc(sizeof(message));
+
+    if(snapshot_get_message(next, end, port->restore_frame) == NULL) {
+      free(port->restore_frame);
+      port->restore_frame = NULL;
+      return -1;
+    }
+  }
+
+  port->sent_flag = section->sent_flag;
+  port->sent_id = section->sent_id;
+  port->sent_dest = section->sent_dest;
+  port->queue_high_water = section->queue_high_water;
+  port->hops = section->hops;
+  port->sent = section->sent;
+  port->received = section->received;
+  port->forwarded = section->forwarded;
+  port->corrupted = section->corrupted;
+
+  return 0;
+}
+
+// Returns the value of the "<field>: <n> kB" line of a /proc file, or 0 if it isn't there
+static unsigned long node_proc_field_kb(const char *path, const char *field) {
+  char line[128];
+  size_t field_length = strlen(field);
+  unsigned long value = 0;
+  FILE *proc_file = fopen(path, "r");
+
+  if(proc_file == NULL) {
+    return 0;
+  }
+
+  while(fgets(line, sizeof(line), proc_file) != NULL) {
+    if(strncmp(line, field, field_length) == 0 && line[field_length] == ':') {
+      value = strtoul(line + field_length + 1, NULL, 10);
+      break;
+    }
+  }
+
+  fclose(proc_file);
+
+  return value;
+}
+
+int node_memory_usage(int pid, node_memory *usage) {
+  char proc_dir[32];
+  char path[64];
+
+  if(pid == 0) {
+    snprintf(proc_dir, sizeof(proc_dir), "/proc/self");
+  }
+  else {
+    snprintf(proc_dir, sizeof(proc_dir), "/proc/%d", pid);
+  }
+
+  snprintf(path, sizeof(path), "%s/smaps_rollup", proc_dir);
+
+  if(access(path, R_OK) != 0) {
+    return -1;
+  }
+
+  usage->rss = node_proc_field_kb(path, "Rss");
+  usage->pss = node_proc_field_kb(path, "Pss");
+
+  // The address space size is only in status
+  snprintf(path, sizeof(path), "%s/status", proc_dir);
+  usage->virtual_size = node_proc_field_kb(path, "VmSize");
+
+  return 0;
+}
+
+void node_print_stats(node *n) {
+  node_memory usage;
+  node_port *port;
+  int port_iterator;
+  int depth, high_water;
+  unsigned long hops = 0;
+  unsigned long syscalls = n->admin_syscalls;
+
+  for(port_iterator=0; port_iterator<n->port_count; port_iterator++) {
+    port = &n->ports[port_iterator];
+
+    pthread_mutex_lock(&port->queue_lock);
+    depth = port->queue_depth;
+    high_water = port->queue_high_water;
+    pthread_mutex_unlock(&port->queue_lock);
+
+    printf("%s: %lu hops, %lu sent, %lu received, %lu forwarded, %lu corrupted, %lu unreported, queue depth %d (high water %d).\n",
+	   port->name, port->hops, port->sent, port->received, port->forwarded, port->corrupted, port->unreported,
+	   depth, high_water);
+
+    token_wait_print_stats(&port->wait_state, port->name);
+    PROFILE_PRINT(&port->profile_published, &port->queue_lock, port->name);
+
+    hops += port->hops;
+    syscalls += node_port_syscalls(port);
+  }
+
+  printf("Endpoint %d: %lu I/O system calls over %lu hops (%.2f per hop, %s).\n",
+	 n->token_id, syscalls, hops, hops ? (double)syscalls / hops : 0.0, n->ports[0].engine != NULL ? "io_uring" : "read/write");
+
+  if(node_memory_usage(0, &usage) == 0) {
+    printf("Endpoint %d: %lu kB resident, %lu kB proportional share, %lu kB address space.\n",
+	   n->token_id, usage.rss, usage.pss, usage.virtual_size);
+  }
+
+  if(n->deliveries != NULL) {
+    printf("Endpoint %d: %llu deliveries written to %s.\n", n->token_id, (unsigned long long)mailbox_written(n->deliveries), n->deliveries->path);
+  }
+}
+
+// Token passing thread
+static void *node_token_ring_passer(void *port_descriptor) {
+  node_port *port = port_descriptor;
+  node *owner = port->owner;
+
+  // Thread descriptor variables
+  int token_id = owner->token_id;
+  int token_rd_pipe = port->token_rd_pipe;
+
+  // Message variables
+  message *msg_buffer = message_create(-1, NULL);
+  int msg_dest = 0;
+  int rd_len = 0;
+  int intact, enqueued, idle;
+  PROFILE_DECLARE(phase_start);
+
+  // Pacing variables
+  struct timespec hop_delay;
+  hop_delay.tv_sec = owner->opts->hop_delay_us / 1000000;
+  hop_delay.tv_nsec = (owner->opts->hop_delay_us % 1000000) * 1000L;
+
+  // Token wait variables (io_uring waits in the kernel instead)
+  token_wait *wait_state = &port->wait_state;
+
+  if(port->engine == NULL && token_wait_init(wait_state, token_rd_pipe, owner->opts->spin_max) != 0) {
+    printf("%s: Unable to poll token pipe, falling back to blocking reads.\n", port->name);
+    wait_state->spin_max = wait_state->spin_budget = 0;
+  }
+
+  // Read the first token, later ones are read as the token is passed on
+  node_port_poll_admin(port);
+
+  // The first hop starts with the first read, so its wait is counted like any other
+  PROFILE_HOP(&port->profile);
+
+  if(port->restore_frame != NULL) {
+    memcpy(msg_buffer, port->restore_frame, sizeof(message));
+    free(port->restore_frame);
+    port->restore_frame = NULL;
+    rd_len = sizeof(message);
+  }
+  else {
+    PROFILE_BEGIN(phase_start);
+    rd_len = node_port_read(port, msg_buffer);
+    PROFILE_END(&port->profile, PROFILE_PHASE_READ, phase_start);
+  }
+
+  while(1) {
+    // The previous node has gone away
+    if(rd_len <= 0) {
+      printf("%s: Token pipe closed.\n", port->name);
+
+      // Let the other ring carry anything still queued here
+      node_port_abandon(port);
+      break;
+    }
+
+    PROFILE_HOP(&port->profile);
+    PROFILE_PUBLISH(&port->profile, &port->profile_published, &port->queue_lock);
+
+    // Hold the token while the ring is snapshotted
+    node_port_hold(port, msg_buffer);
+
+    // Periodically report how often the token was caught while spinning
+    if(++port->hops % WAIT_STATS_INTERVAL == 0) {
+      token_wait_print_stats(wait_state, port->name);
+
+      pthread_mutex_lock(&port->queue_lock);
+      printf("%s: Queue depth %d, high water %d.\n", port->name, port->queue_depth, port->queue_high_water);
+      pthread_mutex_unlock(&port->queue_lock);
+
+      if(port->peer != NULL && !owner->dual_ring) {
+	printf("%s: Forwarded %lu frames to ring %d.\n", port->name, port->forwarded, port->peer->ring_id);
+      }
+    }
+
+    // Process
+    // TODO: Handle incomplete reads (not 100% of bytes in first read)
+    printf("\n%s (%d) read in %d of %ld bytes\n", port->name, owner->pid, rd_len, sizeof(message));
+
+    // Any node may fill any empty slot of a slotted ring
+    if(owner->opts->slots > 1) {
+      node_port_process_slot(port, msg_buffer);
+    }
+
+    // Non-blank message received
+    else if(strlen(msg_buffer->header) > 0) {
+
+      PROFILE_BEGIN(phase_start);
+
+      // Get message destination from string
+      msg_dest = strtol(msg_buffer->header, NULL, 10);
+      intact = (msg_dest != token_id && !node_port_should_forward(port, msg_dest)) || message_check(msg_buffer);
+
+      PROFILE_END(&port->profile, PROFILE_PHASE_PARSE, phase_start);
+
+      // Drop damaged frames before acting on them, the sender retransmits
+      if(!intact) {
+	node_port_drop_corrupt(port, msg_buffer);
+      }
+
+      // Handle message reception for this node
+      else if(msg_dest == token_id) {
+	printf("%s: Received message: %s", port->name, msg_buffer->body);
+
+	if(owner->deliveries != NULL) {
+	  mailbox_put(owner->deliveries, msg_buffer, message_clock_ns());
+	}
+
+	// Acknowledge reception of message
+	message_acknowledge(msg_buffer);
+	port->received++;
+
+	node_port_report(port, msg_buffer, msg_dest, MESSAGE_DELIVERED);
+      }
+
+      // Handle message bound for the other side of this bridge
+      else if(node_port_should_forward(port, msg_dest)) {
+	// Queue a copy on the far ring and acknowledge it on this one
+	PROFILE_BEGIN(phase_start);
+	enqueued = node_port_enqueue(port->peer, msg_buffer, NODE_ENQUEUE_TRY);
+	PROFILE_END(&port->profile, PROFILE_PHASE_QUEUE, phase_start);
+
+	if(enqueued == 0) {
+	  printf("%s: Forwarding message for endpoint %d to ring %d.\n", port->name, msg_dest, port->peer->ring_id);
+
+	  port->forwarded++;
+	  message_acknowledge(msg_buffer);
+
+	  node_port_report(port, msg_buffer, msg_dest, MESSAGE_FORWARDED);
+	}
+
+	// Leave it circulating until the far ring has room
+	else {
+	  printf("%s: Ring %d is full, passing message for endpoint %d ahead...\n", port->name, port->peer->ring_id, msg_dest);
+	}
+      }
+
+      // Handle message this port sent coming back around
+      else if(node_port_owns(port, msg_buffer)) {
+	// The frame was damaged on the way around, send it again on the next blank token
+	if(!message_check(msg_buffer)) {
+	  node_port_drop_corrupt(port, msg_buffer);
+	  port->sent_flag = 0;
+	}
+
+	else if(msg_dest == 0) {
+	  printf("%s: Message successfully sent and acknowledged.\n", port->name);
+
+	  // Clear the message sent flag
+	  port->sent_flag = 0;
+
+	  // Finalize message
+	  PROFILE_BEGIN(phase_start);
+	  node_port_dequeue(port);
+	  PROFILE_END(&port->profile, PROFILE_PHASE_QUEUE, phase_start);
+	  port->sent++;
+
+	  node_port_report(port, msg_buffer, port->sent_dest, MESSAGE_COMPLETED);
+
+	  // Turn the message buffer back into a blank token
+	  message_clear(msg_buffer);
+	}
+
+	// A wrapped dual ring still passes every live node, so the destination has failed
+	else if(owner->dual_ring) {
+	  printf("%s: Destination %d is unreachable, dropping message.\n", port->name, port->sent_dest);
+
+	  port->sent_flag = 0;
+	  node_port_dequeue(port);
+
+	  node_port_report(port, msg_buffer, port->sent_dest, MESSAGE_UNDELIVERABLE);
+	  message_clear(msg_buffer);
+	}
+
+	// Handle message not acknowledged
+	else {
+	  printf("%s: Message failed to be received.\n", port->name);
+	}
+      }
+
+      // Handle a copy of a message this node has since given up on (the peer's frame may pass through after a wrap)
+      else if(msg_buffer->source_id == token_id && (port->peer == NULL || !node_port_owns(port->peer, msg_buffer))) {
+	printf("%s: Clearing stale frame.\n", port->name);
+	message_clear(msg_buffer);
+      }
+
+      // Not intended destination, nor did this node send anything
+      else {
+	printf("%s: Passing token ahead...\n", port->name);
+      }
+    }
+
+    // Blank message received
+    else {
+      PROFILE_BEGIN(phase_start);
+      pthread_mutex_lock(&port->queue_lock);
+
+      // If a message is available (a dual ring node may see the other ring's token while its own frame is out)
+      if(port->msg_queue != NULL && (!port->sent_flag || node_port_sent_lost(port, msg_buffer))) {
+	// The frame that was sent never came back
+	if(port->sent_flag) {
+	  printf("%s: Sent message was lost, retransmitting.\n", port->name);
+	}
+
+	printf("%s: Putting new message on blank token.\n", port->name);
+
+	// set the message sent flag
+	port->sent_flag = 1;
+
+	// Copy it from the message queue, it stays queued until acknowledged
+	memcpy(msg_buffer, message_queue_get_message(port->msg_queue), sizeof(message));
+	msg_buffer->source_id = token_id;
+	message_seal(msg_buffer);
+	port->sent_id = msg_buffer->message_id;
+	port->sent_dest = strtol(msg_buffer->header, NULL, 10);
+	port->sent_ns = message_clock_ns();
+      }
+
+      // Pass the message that was received
+      else {
+	// do nothing.
+	printf("%s: Blank token found.\n", port->name);
+      }
+
+      pthread_mutex_unlock(&port->queue_lock);
+      PROFILE_END(&port->profile, PROFILE_PHASE_QUEUE, phase_start);
+    }
+
+    // During shutdown, count how many nodes in a row have had nothing left to send
+    pthread_mutex_lock(&port->queue_lock);
+    idle = owner->draining && port->queue_depth == 0;
+    pthread_mutex_unlock(&port->queue_lock);
+
+    if(idle) {
+      msg_buffer->idle_hops++;
+    }
+    else {
+      msg_buffer->idle_hops = 0;
+    }
+
+    // A bridge holds its ring open while the ring on its other side may still forward messages into it
+    if(port->peer != NULL && !owner->dual_ring) {
+      pthread_mutex_lock(&port->queue_lock);
+      port->quiet = msg_buffer->idle_hops >= node_port_drain_hops(port);
+      pthread_mutex_unlock(&port->queue_lock);
+
+      // Restarting the count here keeps every other node short of it, an idle revolution still brings it back full
+      if(!node_port_peer_quiet(port)) {
+	msg_buffer->idle_hops = 0;
+      }
+    }
+
+    // Every node on the ring is idle, pass the news along and stop
+    if(msg_buffer->idle_hops >= node_port_drain_hops(port)) {
+      node_port_write(port, msg_buffer);
+
+      printf("%s: Ring drained.\n", port->name);
+
+      pthread_mutex_lock(&port->queue_lock);
+      port->drained = 1;
+      pthread_mutex_unlock(&port->queue_lock);
+      break;
+    }
+
+    // Wait for the configured hop delay (allows progress to be tracked by humans), write and read the next token
+    rd_len = node_port_pass(port, msg_buffer, &hop_delay);
+
+    node_port_poll_admin(port);
+  }
+
+  // Leave the last hop's phases in the stats printed at shutdown
+  PROFILE_PUBLISH(&port->profile, &port->profile_published, &port->queue_lock);
+
+  if(port->engine != NULL) {
+    io_engine_close(port->engine);
+  }
+
+  free(msg_buffer);
+
+  return NULL;
+}
+
+// Admin message handling thread
+static void *node_admin_thread_handler(void *node_descriptor) {
+  node *owner = node_descriptor;
+
+  // Thread descriptor variables
+  int admin_rd_pipe = owner->admin_rd_pipe;
+
+  // Message variables
+  message *msg_buffer = malloc(sizeof(message));
+  node_port *port;
+  int msg_dest;
+
+  while(1) {
+    // Read
+    owner->admin_syscalls++;
+
+    if(read(admin_rd_pipe, msg_buffer, sizeof(message)) <= 0) {
+      // The admin process has closed its end
+      break;
+    }
+
+    // Process (keep reading while draining, so the admin process never blocks on the pipe)
+    msg_dest = strtol(msg_buffer->header, NULL, 10);
+    port = node_select_port(owner, msg_dest);
+
+    if(node_port_enqueue(port, msg_buffer, NODE_ENQUEUE_WAIT) == 0) {
+      continue;
+    }
+
+    // The port's ring was cut while waiting for room, try the one that is left
+    if(!owner->draining && port != node_select_port(owner, msg_dest)) {
+      port = node_select_port(owner, msg_dest);
+
+      if(node_port_enqueue(port, msg_buffer, NODE_ENQUEUE_WAIT) == 0) {
+	continue;
+      }
+    }
+
+    if(owner->draining) {
+      owner->admin_refused++;
+    }
+    else {
+      printf("%s: No ring left to send message %d on, dropping it.\n", port->name, msg_buffer->message_id);
+      node_port_report(port, msg_buffer, msg_dest, MESSAGE_UNDELIVERABLE);
+    }
+
+    // Write (if necessary)
+  }
+
+  free(msg_buffer);
+
+  return NULL;
+}
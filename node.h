@@ -0,0 +1,231 @@
+/** @file node.h
+ *  @brief Function prototypes and structure definitions for the node library.
+ *
+ * The node library is developed to hold the behaviour
+ * of a token ring node process: the token ring thread(s)
+ * that pass the token and the admin thread that receives
+ * messages from the admin process.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __NODE_H__
+#define __NODE_H__
+
+#include <pthread.h>
+
+#include "endpoint.h"
+#include "io_engine.h"
+#include "mailbox.h"
+#include "message.h"
+#include "options.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "token_wait.h"
+
+#define NODE_MAX_PORTS 2
+#define NODE_NAME_LENGTH 32
+#define NODE_SLIM_STACK_SIZE (64 * 1024)  // Thread stack size of slim nodes
+#define NODE_MAX_SLOTS 32      // Most frame slots a slotted ring can carry (all of them fit in a token pipe)
+
+// Ways of adding a message to a full port queue
+#define NODE_ENQUEUE_WAIT 0   // Block until there is room
+#define NODE_ENQUEUE_TRY 1    // Fail if there is no room
+#define NODE_ENQUEUE_FORCE 2  // Ignore the queue depth limit
+
+struct node;
+
+// A node's attachment to a single ring
+typedef struct node_port {
+  struct node *owner;
+  struct node_port *peer;       // Other port of a bridge or dual ring node (NULL otherwise)
+  char name[NODE_NAME_LENGTH];  // Name used in diagnostic output
+  int ring_id;
+  int ring_size;                // Members (endpoints and bridges) on this port's ring
+  int token_rd_pipe;
+  int token_wr_pipe;            // Switched to the peer's output when the ring wraps
+  int alive;                    // Cleared once the previous node on this ring has gone away
+  int forward_ring_lo;          // Frames for rings in [lo, hi] are handed to the peer
+  int forward_ring_hi;
+  message_queue *msg_queue;     // Messages waiting for a blank token on this ring
+  int queue_depth;              // Messages currently in msg_queue
+  int queue_high_water;         // Deepest msg_queue has been
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_not_full;
+  token_wait wait_state;        // Adaptive token wait state and counters
+  io_engine *engine;            // io_uring engine for the token pipes (NULL when using read and write)
+  unsigned long syscalls;       // Writes and sleeps made by the token thread (reads are counted by wait_state)
+  unsigned long hops;           // Tokens read
+  unsigned long sent;           // Messages sent and acknowledged
+  unsigned long received;       // Messages delivered to this node
+  unsigned long forwarded;      // Frames handed to the peer port
+  unsigned long corrupted;      // Frames dropped for a bad frame check sequence
+  unsigned long unreported;     // Completion records lost to a full completion pipe
+  int drained;                  // Set once the whole ring has nothing left to send during shutdown
+  int quiet;                    // The last token seen had gone a whole revolution idle (bridges only, under queue_lock)
+  int sent_flag;                // The message at the head of the queue is out on the ring
+  int sent_id;                  // Id and destination of the message out on the ring
+  int sent_dest;
+  int64_t sent_ns;              // CLOCK_MONOTONIC time the message was put on the ring
+  int in_flight_id[NODE_MAX_SLOTS];    // Id and destination of every message out on a slot (slotted rings only)
+  int in_flight_dest[NODE_MAX_SLOTS];
+  unsigned long in_flight_hop[NODE_MAX_SLOTS];   // Hop the slot was filled on, it is due back after one hop per slot
+  int in_flight_count;
+  message *restore_frame;       // Token held when the node was snapshotted, passed on first when restored
+#ifdef TOKEN_RING_PROFILE
+  profile_phases profile;       // Time spent in each phase of a hop, token thread only
+  profile_phases profile_published;    // Copy of profile as of the last hop, under queue_lock
+#endif
+  pthread_t token_thread;
+} node_port;
+
+// Memory used by a node process, in kB
+typedef struct node_memory {
+  unsigned long rss;            // Resident, including pages shared with other processes
+  unsigned long pss;            // Resident, with shared pages split between the processes sharing them
+  unsigned long virtual_size;   // Address space reserved (stacks, malloc arenas, mappings)
+} node_memory;
+
+// A single node process
+typedef struct node {
+  int token_id;
+  int pid;
+  int port_count;
+  node_port ports[NODE_MAX_PORTS];
+  int admin_rd_pipe;
+  int completion_wr_pipe;       // Shared pipe for reporting progress to the admin process (-1 if none)
+  int admin_in_engine;          // The admin pipe is read by the only port's io_uring engine, not the admin thread
+  message *admin_buffer;        // Admin message read by the engine
+  int admin_pending;            // admin_buffer holds a message waiting for room in the queue
+  unsigned long admin_syscalls; // Reads made by the admin thread
+  unsigned long admin_refused;  // Admin messages turned away because the node was draining
+  int dual_ring;                // Ports are the primary and counter-rotating secondary ring
+  volatile int draining;        // Shutdown requested, finish queued messages then stop
+  volatile int pausing;         // Snapshot requested, hold the token when it arrives
+  message *held_token;          // Token being held for a snapshot
+  pthread_mutex_t pause_lock;
+  pthread_cond_t resumed;
+  mailbox *deliveries;          // Shared ring consumers read deliveries from (NULL if not enabled)
+  int *route_table;             // Ring id for every token id (bridges only)
+  int route_table_length;
+  const simulator_options *opts;
+  pthread_t admin_thread;
+} node;
+
+/** @brief Creates the node state for the supplied endpoint.
+ *
+ *  Builds a node with one port per ring the endpoint is
+ *  attached to. When the endpoint bridges two rings, the
+ *  supplied route table is used to decide which frames
+ *  are forwarded to the other ring. In dual ring mode the
+ *  second port is the counter-rotating secondary ring.
+ *  The node takes ownership of the route table.
+ *
+ *  Deliveries, completions and forwards are reported to
+ *  the admin process on the completion pipe. Records are
+ *  dropped (and counted) rather than block the token.
+ *
+ *  @param endp The endpoint descriptor for this node process.
+ *  @param opts The simulator options.
+ *  @param ring_sizes The number of members on every ring, indexed by ring id.
+ *  @param completion_wr_pipe Non-blocking write end of the shared completion pipe, or -1.
+ *  @param route_table Ring id of every token id, or NULL for ordinary nodes.
+ *  @param route_table_length The number of entries in route_table.
+ *  @return The new node, or a NULL pointer on failure.
+ */
+node *node_create(endpoint *endp, const simulator_options *opts, const int *ring_sizes, int completion_wr_pipe, int *route_table, int route_table_length);
+
+/** @brief Starts the admin thread and a token ring thread for every port.
+ *
+ *  Slim nodes (see simulator_options) give their threads
+ *  NODE_SLIM_STACK_SIZE stacks instead of the default.
+ *  With the io_uring option, every port gets an io_engine
+ *  that passes the token on and reads the next one in a
+ *  single system call. A node with a single port reads the
+ *  admin pipe on the same engine instead of starting an
+ *  admin thread. Ports fall back to read and write when
+ *  io_uring is unavailable.
+ *
+ *  @param n The node to be started.
+ *  @return Zero on success, -1 if a thread could not be created.
+ */
+int node_start(node *n);
+
+/** @brief Drains the node's queues and prints its final counters.
+ *
+ *  Tells every port to stop once its whole ring has nothing
+ *  left to send, then waits for that to happen. Ports that
+ *  haven't drained when the deadline passes abandon whatever
+ *  is still queued. Returns once every port has drained or
+ *  been abandoned; the caller is expected to exit.
+ *
+ *  @param n The node to be shut down.
+ *  @param deadline_ms Milliseconds allowed for draining.
+ *  @return The number of messages abandoned.
+ */
+int node_shutdown(node *n, int deadline_ms);
+
+/** @brief Asks the node to hold the token the next time it arrives.
+ *
+ *  The node that ends up holding the token reports
+ *  MESSAGE_PAUSED on the completion pipe. Every other
+ *  node is then idle, waiting for the token.
+ *
+ *  @param n The node to be paused.
+ *  @return Void.
+ */
+void node_pause(node *n);
+
+/** @brief Appends the node's section to a snapshot and resumes the node.
+ *
+ *  Saves the queue, the counters and the token (if the
+ *  node is holding it) of a paused node, then lets the
+ *  token go again. Reports MESSAGE_SNAPSHOTTED on the
+ *  completion pipe when done. Only single ring nodes
+ *  can be snapshotted.
+ *
+ *  @param n The node to be saved.
+ *  @param path The snapshot file, which must already hold the header.
+ *  @return Zero on success, -1 on failure.
+ */
+int node_snapshot(node *n, const char *path);
+
+/** @brief Lets the token go again without saving anything.
+ *
+ *  Used when a snapshot is given up on before the node's
+ *  turn, so the ring isn't left paused.
+ *
+ *  @param n The node to be resumed.
+ *  @return Void.
+ */
+void node_resume(node *n);
+
+/** @brief Loads the node's section of a snapshot.
+ *
+ *  Requeues the saved messages and restores the counters.
+ *  The node that held the token passes it on first thing
+ *  when started. Must be called before node_start.
+ *
+ *  @param n The node to be restored.
+ *  @param snap The snapshot to restore from.
+ *  @return Zero on success, -1 if the node's section is missing or damaged.
+ */
+int node_restore(node *n, const snapshot *snap);
+
+/** @brief Reads the memory usage of a process from /proc.
+ *
+ *  @param pid The process to look at, or 0 for the calling process.
+ *  @param usage The usage to be filled in.
+ *  @return Zero on success, -1 if /proc/<pid>/smaps_rollup can't be read.
+ */
+int node_memory_usage(int pid, node_memory *usage);
+
+/** @brief Prints the counters of every port of the node.
+ *
+ *  @param n The node to be printed.
+ *  @return Void.
+ */
+void node_print_stats(node *n);
+
+#endif // __NODE_H__
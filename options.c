@@ -0,0 +1,192 @@
+/** @file options.c
+ *  @brief Function definitions for the options library.
+ *
+ * The options library is developed to allow the
+ * token ring simulator to be tuned from the command
+ * line without recompiling.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mailbox.h"
+#include "node.h"
+#include "options.h"
+#include "snapshot.h"
+#include "token_wait.h"
+
+// Parses a non-negative integer option value, returns -1 on bad input
+static int options_parse_count(const char *text) {
+  char *end;
+  long value = strtol(text, &end, 10);
+
+  if(end == text || *end != '\0' || value < 0 || value > 0x7fffffff) {
+    return -1;
+  }
+
+  return (int)value;
+}
+
+void options_init(simulator_options *opts) {
+  opts->hop_delay_us = SIMULATION_SLEEP_TIME * 1000000;
+  opts->spin_max = TOKEN_WAIT_SPIN_DEFAULT;
+  opts->rings = 1;
+  opts->dual_ring = 0;
+  opts->queue_depth = QUEUE_DEPTH_DEFAULT;
+  opts->drain_deadline_ms = DRAIN_DEADLINE_AUTO;
+  opts->io_uring = 0;
+  opts->snapshot_path = SNAPSHOT_PATH_DEFAULT;
+  opts->restore_path = NULL;
+  opts->mailbox_dir = NULL;
+  opts->slim = 0;
+  opts->control_path = NULL;
+  opts->slots = 1;
+}
+
+int options_parse(int argc, char *argv[], simulator_options *opts) {
+  int opt;
+
+  while((opt = getopt(argc, argv, "d:s:r:Dq:t:uS:R:m:Lc:n:h")) != -1) {
+    switch(opt) {
+    case 'd':
+      opts->hop_delay_us = options_parse_count(optarg);
+
+      if(opts->hop_delay_us < 0) {
+	fprintf(stderr, "ERROR: Invalid hop delay '%s'.\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 's':
+      opts->spin_max = options_parse_count(optarg);
+
+      if(opts->spin_max < 0) {
+	fprintf(stderr, "ERROR: Invalid spin budget '%s'.\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'r':
+      opts->rings = options_parse_count(optarg);
+
+      if(opts->rings < 1) {
+	fprintf(stderr, "ERROR: Invalid ring count '%s'.\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'D':
+      opts->dual_ring = 1;
+      break;
+
+    case 'q':
+      opts->queue_depth = options_parse_count(optarg);
+
+      if(opts->queue_depth < 0) {
+	fprintf(stderr, "ERROR: Invalid queue depth '%s'.\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 't':
+      opts->drain_deadline_ms = options_parse_count(optarg);
+
+      if(opts->drain_deadline_ms < 0) {
+	fprintf(stderr, "ERROR: Invalid drain deadline '%s'.\n", optarg);
+	return -1;
+      }
+      break;
+
+    case 'u':
+      opts->io_uring = 1;
+      break;
+
+    case 'S':
+      opts->snapshot_path = optarg;
+      break;
+
+    case 'R':
+      opts->restore_path = optarg;
+      break;
+
+    case 'm':
+      opts->mailbox_dir = optarg;
+      break;
+
+    case 'L':
+      opts->slim = 1;
+      break;
+
+    case 'c':
+      opts->control_path = optarg;
+      break;
+
+    case 'n':
+      opts->slots = options_parse_count(optarg);
+
+      if(opts->slots < 1 || opts->slots > NODE_MAX_SLOTS) {
+	fprintf(stderr, "ERROR: Invalid slot count '%s' (1 to %d).\n", optarg, NODE_MAX_SLOTS);
+	return -1;
+      }
+      break;
+
+    default:
+      return -1;
+    }
+  }
+
+  // Counter-rotating rings only make sense for a single ring
+  if(opts->dual_ring && opts->rings > 1) {
+    fprintf(stderr, "ERROR: Dual ring mode can't be combined with multiple rings.\n");
+    return -1;
+  }
+
+  // Snapshots only cover a single ring
+  if(opts->restore_path != NULL && (opts->dual_ring || opts->rings > 1)) {
+    fprintf(stderr, "ERROR: Only a single ring can be restored from a snapshot.\n");
+    return -1;
+  }
+
+  // Slotted rings don't bridge, wrap or snapshot
+  if(opts->slots > 1 && (opts->dual_ring || opts->rings > 1 || opts->restore_path != NULL)) {
+    fprintf(stderr, "ERROR: Slotted ring mode needs a single ring that isn't restored from a snapshot.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int options_drain_deadline_ms(const simulator_options *opts, int ring_members) {
+  long deadline_ms = (long)DRAIN_DEADLINE_REVOLUTIONS * ring_members * (opts->hop_delay_us / 1000);
+
+  if(opts->drain_deadline_ms != DRAIN_DEADLINE_AUTO) {
+    return opts->drain_deadline_ms;
+  }
+
+  if(deadline_ms < DRAIN_DEADLINE_DEFAULT_MS) {
+    return DRAIN_DEADLINE_DEFAULT_MS;
+  }
+
+  return deadline_ms > 0x7fffffff ? 0x7fffffff : (int)deadline_ms;
+}
+
+void options_print_usage(const char *program_name) {
+  fprintf(stderr, "Usage: %s [-d hop_delay_us] [-s spin_max] [-r rings] [-D] [-q queue_depth] [-t drain_ms] [-u] [-S snapshot_file] [-R snapshot_file] [-m mailbox_dir] [-L] [-c control_socket] [-n slots]\n", program_name);
+  fprintf(stderr, "  -d  Microseconds each node holds the token (default %d, 0 = flat out)\n", SIMULATION_SLEEP_TIME * 1000000);
+  fprintf(stderr, "  -s  Maximum busy-poll iterations while waiting for the token (default %d, 0 = always block)\n", TOKEN_WAIT_SPIN_DEFAULT);
+  fprintf(stderr, "  -r  Number of rings the endpoints are split across, joined by bridge nodes (default 1)\n");
+  fprintf(stderr, "  -D  Dual ring mode: add a counter-rotating secondary ring that wraps around failed nodes\n");
+  fprintf(stderr, "  -q  Messages queued per node before the admin process defers, then rejects, new ones (default %d, 0 = unbounded)\n", QUEUE_DEPTH_DEFAULT);
+  fprintf(stderr, "  -t  Milliseconds nodes get to drain their queues on quit or ^C (default %d revolutions of the ring, at least %d)\n", DRAIN_DEADLINE_REVOLUTIONS, DRAIN_DEADLINE_DEFAULT_MS);
+  fprintf(stderr, "  -u  Pass the token with io_uring, one system call per hop (falls back to read and write when unavailable)\n");
+  fprintf(stderr, "  -S  File the snapshot command writes to (default %s)\n", SNAPSHOT_PATH_DEFAULT);
+  fprintf(stderr, "  -R  Restart a single ring from a snapshot instead of asking for the number of endpoints\n");
+  fprintf(stderr, "  -m  Copy every delivery into <mailbox_dir>/mailbox.<endpoint>, a shared ring of the last %d deliveries\n", MAILBOX_SLOTS_DEFAULT);
+  fprintf(stderr, "  -L  Slim nodes: %d KiB thread stacks, a single malloc arena and no state inherited from the admin process\n", NODE_SLIM_STACK_SIZE / 1024);
+  fprintf(stderr, "  -c  Also take send, burst, stats and quit commands from clients of this UNIX socket\n");
+  fprintf(stderr, "  -n  Slotted ring mode: circulate this many frame slots any node may fill (default 1, a single token, at most %d)\n", NODE_MAX_SLOTS);
+}
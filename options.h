@@ -0,0 +1,81 @@
+/** @file options.h
+ *  @brief Function prototypes and structure definitions for the options library.
+ *
+ * The options library is developed to allow the
+ * token ring simulator to be tuned from the command
+ * line without recompiling.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__
+
+#define SIMULATION_SLEEP_TIME 1
+#define QUEUE_DEPTH_DEFAULT 64
+#define DRAIN_DEADLINE_DEFAULT_MS 5000
+#define DRAIN_DEADLINE_AUTO -1        // Scale the drain deadline to the ring
+#define DRAIN_DEADLINE_REVOLUTIONS 4  // Token revolutions the automatic drain deadline allows for
+
+// Simulator tuning knobs
+typedef struct simulator_options {
+  int hop_delay_us;  // Pause between reading and writing the token (0 = flat out)
+  int spin_max;      // Upper bound on busy-poll iterations while waiting for the token
+  int rings;         // Number of independent rings joined by bridge nodes
+  int dual_ring;     // Run a counter-rotating secondary ring alongside the primary
+  int queue_depth;   // Messages each node (and the admin process per node) may hold (0 = unbounded)
+  int drain_deadline_ms;  // Time nodes get to empty their queues on shutdown (DRAIN_DEADLINE_AUTO to scale with the ring)
+  int io_uring;      // Pass the token with linked io_uring batches instead of read and write
+  const char *snapshot_path;  // File written by the snapshot command
+  const char *restore_path;   // Snapshot to restart the ring from (NULL to start empty)
+  const char *mailbox_dir;    // Directory of the per-node delivery mailboxes (NULL for none)
+  int slim;          // Small thread stacks, one malloc arena and no inherited admin state in nodes
+  const char *control_path;   // UNIX socket the admin process takes commands on (NULL for none)
+  int slots;         // Frame slots circulating on the ring (1 = a single token)
+} simulator_options;
+
+/** @brief Fills the supplied options struct with default values.
+ *
+ *  The defaults reproduce the original human-watchable
+ *  simulation: a SIMULATION_SLEEP_TIME second pause on
+ *  every hop and the default token wait spin budget.
+ *
+ *  @param opts The options struct to be initialized.
+ *  @return Void.
+ */
+void options_init(simulator_options *opts);
+
+/** @brief Parses the command line into the supplied options struct.
+ *
+ *  Parses the command line arguments supplied to main and
+ *  overrides the matching fields in opts. Values not present
+ *  on the command line are left untouched.
+ *
+ *  @param argc The argument count supplied to main.
+ *  @param argv The argument vector supplied to main.
+ *  @param opts The options struct to be updated.
+ *  @return Zero on success, -1 on invalid arguments.
+ */
+int options_parse(int argc, char *argv[], simulator_options *opts);
+
+/** @brief Returns the time nodes get to drain their queues on shutdown.
+ *
+ *  Unless a deadline was given with -t, this is the longer
+ *  of DRAIN_DEADLINE_DEFAULT_MS and DRAIN_DEADLINE_REVOLUTIONS
+ *  revolutions of a ring with the supplied number of members.
+ *
+ *  @param opts The simulator options.
+ *  @param ring_members The number of nodes the token passes on the longest trip around.
+ *  @return The drain deadline in milliseconds.
+ */
+int options_drain_deadline_ms(const simulator_options *opts, int ring_members);
+
+/** @brief Prints the command line usage to standard error.
+ *
+ *  @param program_name The name the program was invoked as.
+ *  @return Void.
+ */
+void options_print_usage(const char *program_name);
+
+#endif // __OPTIONS_H__
@@ -0,0 +1,145 @@
+/** @file profile.h
+ *  @brief Macros for timing the phases of a token hop.
+ *
+ * The profile macros are developed to show where the time
+ * of each hop goes inside the token ring thread. They are
+ * compiled out unless TOKEN_RING_PROFILE is defined (see
+ * make profile), in which case every phase is timed with
+ * CLOCK_MONOTONIC_RAW and added to per port accumulators.
+ *
+ * Only the token thread touches its accumulators. Once a hop
+ * it publishes a copy under the port's queue lock, and stats
+ * printed from other threads read that copy under the same
+ * lock, so a printed table is never torn by a hop in progress.
+ *
+ * With profiling compiled out the macros expand to nothing,
+ * so the accumulators and the clock reads cost nothing.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+// Phases of a hop
+#define PROFILE_PHASE_READ 0    // Waiting for and reading the token (the whole pass with io_uring)
+#define PROFILE_PHASE_PARSE 1   // Header parse and frame check
+#define PROFILE_PHASE_QUEUE 2   // Message queue access, including waiting for its lock
+#define PROFILE_PHASE_PACING 3  // Hop delay
+#define PROFILE_PHASE_WRITE 4   // Passing the token on
+#define PROFILE_PHASES 5
+
+#ifdef TOKEN_RING_PROFILE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PROFILE_ENABLED 1
+
+// Time spent in every phase by a single token thread
+typedef struct profile_phases {
+  uint64_t hops;
+  uint64_t hop_ns;              // Time from the start of one hop to the start of the next
+  int64_t hop_start;
+  uint64_t count[PROFILE_PHASES];
+  uint64_t total_ns[PROFILE_PHASES];
+  uint64_t max_ns[PROFILE_PHASES];
+} profile_phases;
+
+static const char *const profile_phase_names[PROFILE_PHASES] = {"read", "parse", "queue", "pacing", "write"};
+
+static inline int64_t profile_clock_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+  return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static inline void profile_record(profile_phases *prof, int phase, int64_t start) {
+  uint64_t elapsed = profile_clock_ns() - start;
+
+  prof->count[phase]++;
+  prof->total_ns[phase] += elapsed;
+
+  if(elapsed > prof->max_ns[phase]) {
+    prof->max_ns[phase] = elapsed;
+  }
+}
+
+static inline void profile_hop(profile_phases *prof) {
+  int64_t now = profile_clock_ns();
+
+  if(prof->hop_start != 0) {
+    prof->hops++;
+    prof->hop_ns += now - prof->hop_start;
+  }
+
+  prof->hop_start = now;
+}
+
+// Prints a line per phase, plus whatever wasn't in any phase (logging, completion reports)
+static inline void profile_print(const profile_phases *prof, const char *name) {
+  uint64_t accounted = 0;
+  int phase;
+
+  printf("%s: Hop profile over %llu hops, %.0f ns per hop:\n", name, (unsigned long long)prof->hops,
+	 prof->hops ? (double)prof->hop_ns / prof->hops : 0.0);
+
+  for(phase=0; phase<PROFILE_PHASES; phase++) {
+    printf("%s:   %-8s %10llu times, %12.0f ns average, %12llu ns max, %5.1f%%\n", name, profile_phase_names[phase],
+	   (unsigned long long)prof->count[phase], prof->count[phase] ? (double)prof->total_ns[phase] / prof->count[phase] : 0.0,
+	   (unsigned long long)prof->max_ns[phase], prof->hop_ns ? 100.0 * prof->total_ns[phase] / prof->hop_ns : 0.0);
+
+    accounted += prof->total_ns[phase];
+  }
+
+  // The hop in progress isn't in hop_ns yet, so its phases can tip accounted over
+  if(accounted < prof->hop_ns) {
+    printf("%s:   %-8s %10llu times, %12.0f ns average,%21s %5.1f%%\n", name, "other", (unsigned long long)prof->hops,
+	   prof->hops ? (double)(prof->hop_ns - accounted) / prof->hops : 0.0, "", 100.0 * (prof->hop_ns - accounted) / prof->hop_ns);
+  }
+}
+
+// Copies the token thread's accumulators to where other threads can read them
+static inline void profile_publish(const profile_phases *prof, profile_phases *published, pthread_mutex_t *lock) {
+  pthread_mutex_lock(lock);
+  *published = *prof;
+  pthread_mutex_unlock(lock);
+}
+
+// Prints the last published accumulators, safe from any thread
+static inline void profile_print_published(const profile_phases *published, pthread_mutex_t *lock, const char *name) {
+  profile_phases snapshot;
+
+  pthread_mutex_lock(lock);
+  snapshot = *published;
+  pthread_mutex_unlock(lock);
+
+  profile_print(&snapshot, name);
+}
+
+#define PROFILE_DECLARE(mark) int64_t mark = 0
+#define PROFILE_BEGIN(mark) ((mark) = profile_clock_ns())
+#define PROFILE_END(prof, phase, mark) profile_record((prof), (phase), (mark))
+#define PROFILE_HOP(prof) profile_hop(prof)
+#define PROFILE_PUBLISH(prof, published, lock) profile_publish((prof), (published), (lock))
+#define PROFILE_PRINT(published, lock, name) profile_print_published((published), (lock), (name))
+
+#else
+
+#define PROFILE_ENABLED 0
+
+#define PROFILE_DECLARE(mark)
+#define PROFILE_BEGIN(mark) ((void)0)
+#define PROFILE_END(prof, phase, mark) ((void)0)
+#define PROFILE_HOP(prof) ((void)0)
+#define PROFILE_PUBLISH(prof, published, lock) ((void)0)
+#define PROFILE_PRINT(published, lock, name) ((void)0)
+
+#endif // TOKEN_RING_PROFILE
+
+#endif // __PROFILE_H__
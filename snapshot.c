@@ -0,0 +1,202 @@
+/** @file snapshot.c
+ *  @brief Function definitions for the snapshot library.
+ *
+ * The snapshot library is developed to save the state of
+ * a paused ring (topology, node queues, the token and the
+ * node counters) to a compact binary file, and to map such
+ * a file back in so the ring can be restarted from it.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+// Stored messages and sections stay 8 byte aligned
+#define SNAPSHOT_ALIGN(len) (((len) + 7) & ~(size_t)7)
+
+// Writes the whole buffer, returns -1 on failure
+static int snapshot_write_all(int fd, const void *buf, size_t len) {
+  const char *next = buf;
+  ssize_t wr_len;
+
+  while(len > 0) {
+    wr_len = write(fd, next, len);
+
+    if(wr_len <= 0) {
+      return -1;
+    }
+
+    next += wr_len;
+    len -= wr_len;
+  }
+
+  return 0;
+}
+
+size_t snapshot_message_size(const message *msg) {
+  return sizeof(snapshot_message) +
+    SNAPSHOT_ALIGN(strnlen(msg->header, MESSAGE_MAX_HEADER_LENGTH) + strnlen(msg->body, MESSAGE_MAX_BODY_LENGTH));
+}
+
+char *snapshot_put_message(char *out, const message *msg) {
+  snapshot_message stored;
+  size_t size = snapshot_message_size(msg);
+
+  memset(&stored, 0, sizeof(stored));
+  stored.message_id = msg->message_id;
+  stored.source_id = msg->source_id;
+  stored.created_ns = msg->created_ns;
+  stored.header_length = strnlen(msg->header, MESSAGE_MAX_HEADER_LENGTH);
+  stored.body_length = strnlen(msg->body, MESSAGE_MAX_BODY_LENGTH);
+
+  memset(out, 0, size);
+  memcpy(out, &stored, sizeof(stored));
+  memcpy(out + sizeof(stored), msg->header, stored.header_length);
+  memcpy(out + sizeof(stored) + stored.header_length, msg->body, stored.body_length);
+
+  return out + size;
+}
+
+const char *snapshot_get_message(const char *in, const char *end, message *msg) {
+  snapshot_message stored;
+  size_t size;
+
+  if(end - in < (ptrdiff_t)sizeof(stored)) {
+    return NULL;
+  }
+
+  memcpy(&stored, in, sizeof(stored));
+  size = sizeof(stored) + SNAPSHOT_ALIGN(stored.header_length + stored.body_length);
+
+  if(stored.header_length >= MESSAGE_MAX_HEADER_LENGTH || stored.body_length >= MESSAGE_MAX_BODY_LENGTH ||
+     end - in < (ptrdiff_t)size) {
+    return NULL;
+  }
+
+  memset(msg, 0, sizeof(message));
+  msg->message_id = stored.message_id;
+  msg->source_id = stored.source_id;
+  msg->created_ns = stored.created_ns;
+  memcpy(msg->header, in + sizeof(stored), stored.header_length);
+  memcpy(msg->body, in + sizeof(stored) + stored.header_length, stored.body_length);
+
+  // The unused bytes weren't stored, so the frame check sequence has to be worked out again
+  message_seal(msg);
+
+  return in + size;
+}
+
+int snapshot_write_header(const char *path, const snapshot_header *header) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int retval;
+
+  if(fd < 0) {
+    return -1;
+  }
+
+  retval = snapshot_write_all(fd, header, sizeof(snapshot_header));
+  close(fd);
+
+  return retval;
+}
+
+int snapshot_append(const char *path, const snapshot_node *section) {
+  int fd = open(path, O_WRONLY | O_APPEND);
+  int retval;
+
+  if(fd < 0) {
+    return -1;
+  }
+
+  retval = snapshot_write_all(fd, section, section->length);
+  close(fd);
+
+  return retval;
+}
+
+int snapshot_open(snapshot *snap, const char *path) {
+  struct stat file_stat;
+  const char *next, *end;
+  const snapshot_node *section;
+  int fd = open(path, O_RDONLY);
+  int section_iterator;
+
+  snap->map = NULL;
+
+  if(fd < 0) {
+    return -1;
+  }
+
+  if(fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(snapshot_header)) {
+    close(fd);
+    return -1;
+  }
+
+  snap->size = file_stat.st_size;
+  snap->map = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(snap->map == MAP_FAILED) {
+    snap->map = NULL;
+    return -1;
+  }
+
+  snap->header = snap->map;
+
+  if(memcmp(snap->header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0 || snap->header->node_count < 1) {
+    snapshot_close(snap);
+    return -1;
+  }
+
+  // Every section has to be there in full
+  next = (const char *)snap->map + sizeof(snapshot_header);
+  end = (const char *)snap->map + snap->size;
+
+  for(section_iterator=0; section_iterator<snap->header->node_count; section_iterator++) {
+    section = (const snapshot_node *)next;
+
+    if(end - next < (ptrdiff_t)sizeof(snapshot_node) || section->length < sizeof(snapshot_node) ||
+       end - next < (ptrdiff_t)section->length) {
+      snapshot_close(snap);
+      return -1;
+    }
+
+    next += section->length;
+  }
+
+  return 0;
+}
+
+const snapshot_node *snapshot_find_node(const snapshot *snap, int token_id) {
+  const char *next = (const char *)snap->map + sizeof(snapshot_header);
+  const snapshot_node *section;
+  int section_iterator;
+
+  for(section_iterator=0; section_iterator<snap->header->node_count; section_iterator++) {
+    section = (const snapshot_node *)next;
+
+    if(section->token_id == token_id) {
+      return section;
+    }
+
+    next += section->length;
+  }
+
+  return NULL;
+}
+
+void snapshot_close(snapshot *snap) {
+  if(snap->map != NULL) {
+    munmap(snap->map, snap->size);
+  }
+
+  snap->map = NULL;
+  snap->header = NULL;
+}
@@ -0,0 +1,140 @@
+/** @file snapshot.h
+ *  @brief Function prototypes and structure definitions for the snapshot library.
+ *
+ * The snapshot library is developed to save the state of
+ * a paused ring (topology, node queues, the token and the
+ * node counters) to a compact binary file, and to map such
+ * a file back in so the ring can be restarted from it.
+ *
+ * A snapshot is a snapshot_header followed by one section
+ * per node. Each section is a snapshot_node followed by the
+ * node's queued messages and, for the node that held the
+ * token, the token itself. Messages are stored without the
+ * unused parts of their header and body.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "message.h"
+
+#define SNAPSHOT_MAGIC "TRSNAP01"
+#define SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_PATH_DEFAULT "snapshot.bin"
+
+// Start of a snapshot file
+typedef struct snapshot_header {
+  char magic[SNAPSHOT_MAGIC_LENGTH];
+  int32_t num_endpoints;
+  int32_t node_count;       // Node sections that follow
+  int32_t token_holder;     // Token id of the node that held the token
+  int32_t next_message_id;  // First message id the admin process may hand out after a restore
+} snapshot_header;
+
+// A single node's section
+typedef struct snapshot_node {
+  uint32_t length;          // Bytes in the section, including this struct
+  int32_t token_id;
+  int32_t queue_length;     // Messages that follow
+  int32_t holds_token;      // The token follows the queued messages
+  int32_t sent_flag;        // The message at the head of the queue is out on the ring
+  int32_t sent_id;
+  int32_t sent_dest;
+  int32_t queue_high_water;
+  uint64_t hops;
+  uint64_t sent;
+  uint64_t received;
+  uint64_t forwarded;
+  uint64_t corrupted;
+} snapshot_node;
+
+// A message with the unused parts of its header and body left out
+typedef struct snapshot_message {
+  int32_t message_id;
+  int32_t source_id;
+  int64_t created_ns;
+  uint16_t header_length;   // Header bytes that follow
+  uint16_t body_length;     // Body bytes that follow the header, padded to 8 bytes
+  uint32_t reserved;
+} snapshot_message;
+
+// A snapshot file mapped into memory
+typedef struct snapshot {
+  void *map;
+  size_t size;
+  const snapshot_header *header;
+} snapshot;
+
+/** @brief Returns the number of bytes the message takes up in a snapshot.
+ *
+ *  @param msg The message to be stored.
+ *  @return The stored size of the message.
+ */
+size_t snapshot_message_size(const message *msg);
+
+/** @brief Stores the message at out.
+ *
+ *  @param out Where to store the message, snapshot_message_size(msg) bytes.
+ *  @param msg The message to be stored.
+ *  @return The byte after the stored message.
+ */
+char *snapshot_put_message(char *out, const message *msg);
+
+/** @brief Loads a stored message and reseals it.
+ *
+ *  @param in The stored message.
+ *  @param end The end of the snapshot, reads never go past it.
+ *  @param msg The message to be filled in.
+ *  @return The byte after the stored message, or NULL if it is damaged.
+ */
+const char *snapshot_get_message(const char *in, const char *end, message *msg);
+
+/** @brief Writes the header of a new snapshot, truncating the file.
+ *
+ *  @param path The snapshot file.
+ *  @param header The header to be written.
+ *  @return Zero on success, -1 on failure.
+ */
+int snapshot_write_header(const char *path, const snapshot_header *header);
+
+/** @brief Appends a node section to the snapshot in a single write.
+ *
+ *  @param path The snapshot file.
+ *  @param section The section to be appended.
+ *  @return Zero on success, -1 on failure.
+ */
+int snapshot_append(const char *path, const snapshot_node *section);
+
+/** @brief Maps a snapshot file into memory and checks it.
+ *
+ *  The mapping is private and read only, so it can be
+ *  shared with the node processes by forking.
+ *
+ *  @param snap The snapshot to be filled in.
+ *  @param path The snapshot file.
+ *  @return Zero on success, -1 if the file can't be read or isn't a whole snapshot.
+ */
+int snapshot_open(snapshot *snap, const char *path);
+
+/** @brief Finds the section of the supplied node.
+ *
+ *  @param snap The snapshot to search.
+ *  @param token_id The token id of the node.
+ *  @return The node's section, or NULL if it isn't in the snapshot.
+ */
+const snapshot_node *snapshot_find_node(const snapshot *snap, int token_id);
+
+/** @brief Unmaps the snapshot.
+ *
+ *  @param snap The snapshot to be closed.
+ *  @return Void.
+ */
+void snapshot_close(snapshot *snap);
+
+#endif // __SNAPSHOT_H__
@@ -12,65 +12,239 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/wait.h>
 
+#include "admin.h"
+#include "control.h"
 #include "endpoint.h"
 #include "message.h"
-
-#define SIMULATION_SLEEP_TIME 1
-#define ENDPOINT_BASE_ADDR 1
-
-void *token_ring_passer(void *endpoint_descriptor);
-void *admin_thread_handler(void *endpoint_descriptor);
+#include "node.h"
+#include "options.h"
+#include "snapshot.h"
+
+#define ADMIN_REAP_POLL_NS 10000000
+#define ADMIN_REAP_GRACE_MS 1000
+#define ADMIN_LOAD_WINDOW_DEFAULT 8
+#define ADMIN_LOAD_STALL_MS 5000
+#define ADMIN_SNAPSHOT_TIMEOUT_MS 5000
+
+// Asks a node to print its counters (and hop profile) to output.txt
+#define NODE_STATS_SIGNAL SIGRTMIN
+
+// Lets a paused node go again when a snapshot is given up on
+#define NODE_RESUME_SIGNAL (SIGRTMIN + 1)
+
+// Pipe bookkeeping used while wiring up the members of a single ring
+typedef struct ring_builder {
+  int wraparound_fd[2];  // Connects the last member back to the first
+  int carry_fd;          // Pipe end shared by the last attached member and the next one
+  int attached;          // Members attached so far
+  int size;              // Total members (endpoints and bridges) in the ring
+  int reversed;          // Token travels from later members to earlier ones
+} ring_builder;
+
+static int ring_member_count(int ring_id, int num_endpoints, const simulator_options *opts);
+static void plan_endpoint(int index, int num_endpoints, const simulator_options *opts, int *ring_id, int *alt_ring_id);
+static int *plan_route_table(int num_processes, int num_endpoints, const simulator_options *opts);
+static void ring_builder_attach(ring_builder *rb, int token_pipe[2]);
+static void ring_builder_release(ring_builder *rb, int token_pipe[2]);
+static void ring_builder_close_foreign(ring_builder *rb, endpoint *endp);
+static void admin_fail_endpoint(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int token_id);
+static void admin_print_channel_stats(admin_channel *admin_pipes, int num_processes);
+static void admin_run_load(admin_channel *admin_pipes, int num_processes, admin_completions *completions, int count, int window);
+static void admin_request_stats(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes);
+static void admin_print_memory(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes);
+static void admin_snapshot(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int num_endpoints, int num_rings, admin_completions *completions, control_server *control);
+static void admin_snapshot_ring(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int num_endpoints, admin_completions *completions);
+static void admin_signal_handler(int signal_number);
+static void admin_shutdown_endpoints(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int deadline_ms);
 
 int child_process_flag = 0;
-int admin_running = 1;
-pthread_t admin_thread, token_thread;
-message_queue *msg_queue = NULL;
+volatile sig_atomic_t admin_running = 1;
+simulator_options sim_options;
 
-int main() {
-  int wraparound_fd[2];
-  int temp_pipe_fd[2];
+int main(int argc, char *argv[]) {
   int num_endpoints;
+  int num_processes;
+  int num_rings;
   int endpoint_iterator;
+  int ring_iterator;
+  int slot_iterator;
+  int ring_id, alt_ring_id;
   endpoint_list *endpoint_list_head = NULL;
   char *output_filename = "output.txt";
   FILE *output_file;
 
+  // Pipe wiring state and member count of every ring
+  ring_builder *rings;
+  int *ring_sizes;
+
+  // The node run by this process (child processes only)
+  node *this_node = NULL;
+
   // A temporary endpoint used to describe the currently operating node [2]
   endpoint *temp_endpoint;
 
-  // Admin pipe descriptors for communicating with nodes [1]
-  int *admin_pipes;
+  // Admin pipe channels for communicating with nodes [1]
+  admin_channel *admin_pipes;
+
+  // Pipe shared by every node for reporting deliveries back to the admin process
+  int completion_pipe[2];
+  admin_completions completions;
+
+  // Socket other processes can send commands to (-c)
+  control_server control;
+
+  // Signals that ask for a graceful shutdown
+  sigset_t shutdown_signals;
+  struct sigaction shutdown_action;
+
+  // Signals nodes wait for: shutdown, pause (SIGUSR1), snapshot (SIGUSR2), stats and resume
+  sigset_t node_signals;
+  sigset_t admin_signals;
+
+  // Snapshot the ring is restarted from (-R)
+  snapshot restore_snap;
+
+  // Read the tuning knobs from the command line
+  options_init(&sim_options);
+
+  if(options_parse(argc, argv, &sim_options) != 0) {
+    options_print_usage(argv[0]);
+    exit(1);
+  }
+
+  // Writes to a node that has gone away are reported as errors instead of killing the writer
+  signal(SIGPIPE, SIG_IGN);
+
+  // ^C and SIGTERM interrupt the admin prompt instead of killing the simulator outright
+  sigemptyset(&shutdown_signals);
+  sigaddset(&shutdown_signals, SIGINT);
+  sigaddset(&shutdown_signals, SIGTERM);
+
+  memset(&shutdown_action, 0, sizeof(shutdown_action));
+  shutdown_action.sa_handler = admin_signal_handler;
+  sigaction(SIGINT, &shutdown_action, NULL);
+  sigaction(SIGTERM, &shutdown_action, NULL);
+
+  node_signals = shutdown_signals;
+  sigaddset(&node_signals, SIGUSR1);
+  sigaddset(&node_signals, SIGUSR2);
+  sigaddset(&node_signals, NODE_STATS_SIGNAL);
+  sigaddset(&node_signals, NODE_RESUME_SIGNAL);
 
   // Welcome the user to the program
   printf("Welcome to the CIS 452 Token Ring Simulator\n");
   printf("===========================================\n");
 
-  // Get the desired number of endpoints to create from the user
-  num_endpoints = request_num_endpoints();
+  // Get the desired number of endpoints to create from the user, or from the snapshot being restored
+  if(sim_options.restore_path != NULL) {
+    if(snapshot_open(&restore_snap, sim_options.restore_path) != 0) {
+      printf("ERROR: %s isn't a readable snapshot.\n", sim_options.restore_path);
+      exit(1);
+    }
+
+    num_endpoints = restore_snap.header->num_endpoints;
+
+    // Carry on numbering messages from where the snapshot left off
+    message_set_next_id(restore_snap.header->next_message_id);
+
+    printf("Restoring %d endpoints from %s...\n", num_endpoints, sim_options.restore_path);
+  }
+  else {
+    num_endpoints = request_num_endpoints();
+  }
+
+  // Every ring needs at least one endpoint of its own
+  if(num_endpoints < sim_options.rings || num_endpoints < 1) {
+    printf("ERROR: %d endpoints can't be split across %d rings.\n", num_endpoints, sim_options.rings);
+    exit(1);
+  }
+
+  // Dual ring mode runs a counter-rotating secondary ring through every endpoint
+  if(sim_options.dual_ring) {
+    num_rings = 2;
+    num_processes = num_endpoints;
+  }
+
+  // Rings are chained together by a bridge process between each neighbouring pair
+  else {
+    num_rings = sim_options.rings;
+    num_processes = num_endpoints + num_rings - 1;
+  }
+
+  // Nodes and the admin process agree on the drain deadline before the nodes are forked
+  sim_options.drain_deadline_ms = options_drain_deadline_ms(&sim_options, num_processes);
+
+  // The snapshot has to cover every node, including the one holding the token
+  if(sim_options.restore_path != NULL &&
+     (restore_snap.header->node_count != num_processes || snapshot_find_node(&restore_snap, restore_snap.header->token_holder) == NULL)) {
+    printf("ERROR: %s doesn't cover the whole ring.\n", sim_options.restore_path);
+    exit(1);
+  }
 
   // Allocate space for admin control pipes [1]
-  admin_pipes = malloc(num_endpoints * sizeof(int));
+  admin_pipes = malloc(num_processes * sizeof(admin_channel));
+
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    admin_pipes[endpoint_iterator].fd = -1;
+  }
 
   // Prompt user
   printf("You have requested %d endpoints. Creating now...\n", num_endpoints);
 
-  if(pipe(wraparound_fd) != 0) {
-    printf("ERROR: Couldn't create the wraparound pipe.\n");
+  // Create the wraparound pipe of every ring before any process is forked
+  rings = malloc(num_rings * sizeof(ring_builder));
+  ring_sizes = malloc(num_rings * sizeof(int));
+
+  for(ring_iterator=0; ring_iterator<num_rings; ring_iterator++) {
+    if(pipe(rings[ring_iterator].wraparound_fd) != 0) {
+      printf("ERROR: Couldn't create the wraparound pipe.\n");
+      exit(1);
+    }
+
+    rings[ring_iterator].carry_fd = -1;
+    rings[ring_iterator].attached = 0;
+    rings[ring_iterator].size = ring_member_count(ring_iterator, num_endpoints, &sim_options);
+    rings[ring_iterator].reversed = sim_options.dual_ring && ring_iterator == 1;
+
+    ring_sizes[ring_iterator] = rings[ring_iterator].size;
+  }
+
+  // Nodes drop completion records rather than stall the token when the admin process falls behind
+  if(pipe(completion_pipe) != 0) {
+    printf("ERROR: Couldn't create the completion pipe.\n");
     exit(1);
   }
 
+  fcntl(completion_pipe[PIPE_WRITE_INDEX], F_SETFL, fcntl(completion_pipe[PIPE_WRITE_INDEX], F_GETFL) | O_NONBLOCK);
+
   // Open handle to output file
   output_file = fopen(output_filename, "a");
 
+  // Nodes are forked with their signals blocked, so one that arrives before a node is set up waits for its sigwait
+  pthread_sigmask(SIG_BLOCK, &node_signals, &admin_signals);
+
   /////////////////////////////////////
   // Create the appropriate endpoints
   /////////////////////////////////////
-  for(endpoint_iterator=ENDPOINT_BASE_ADDR; endpoint_iterator<num_endpoints+ENDPOINT_BASE_ADDR; endpoint_iterator++) {
+  for(endpoint_iterator=ENDPOINT_BASE_ADDR; endpoint_iterator<num_processes+ENDPOINT_BASE_ADDR; endpoint_iterator++) {
+
+    // Work out which ring(s) this endpoint is attached to
+    plan_endpoint(endpoint_iterator - ENDPOINT_BASE_ADDR, num_endpoints, &sim_options, &ring_id, &alt_ring_id);
 
     // Create the endpoint
-    printf("Creating endpoint %d...\n", endpoint_iterator);
-    temp_endpoint = create_endpoint(endpoint_iterator);
+    if(alt_ring_id >= 0 && !sim_options.dual_ring) {
+      printf("Creating bridge endpoint %d between rings %d and %d...\n", endpoint_iterator, ring_id, alt_ring_id);
+    }
+    else {
+      printf("Creating endpoint %d...\n", endpoint_iterator);
+    }
+
+    temp_endpoint = create_endpoint(endpoint_iterator, ring_id, alt_ring_id);
 
     // Handle error in endpoint creation
     if(temp_endpoint == NULL) {
@@ -80,30 +254,14 @@ int main() {
     }
 
     // Connect read node from previous node, save current read node for next connection
-    temp_pipe_fd[1] = temp_endpoint->token_pipe[PIPE_READ_INDEX];
-    temp_endpoint->token_pipe[PIPE_READ_INDEX] = temp_pipe_fd[0];
-    temp_pipe_fd[0] = temp_pipe_fd[1];
+    ring_builder_attach(&rings[ring_id], temp_endpoint->token_pipe);
 
-    // If first element
-    if(endpoint_iterator == ENDPOINT_BASE_ADDR) {
-      // Use read endpoint of wraparound pipe
-      temp_endpoint->token_pipe[PIPE_READ_INDEX] = wraparound_fd[PIPE_READ_INDEX];
-    }
-
-    // Else if last element
-    else if(endpoint_iterator >= num_endpoints + ENDPOINT_BASE_ADDR - 1) {
-      // Close original pipe associated with last element
-      close(temp_pipe_fd[0]);                             // Read end from previous node
-      close(temp_endpoint->token_pipe[PIPE_WRITE_INDEX]); // Write end
-
-      // Use write end of wraparound pipe
-      temp_endpoint->token_pipe[PIPE_WRITE_INDEX] = wraparound_fd[PIPE_WRITE_INDEX];
+    if(alt_ring_id >= 0) {
+      ring_builder_attach(&rings[alt_ring_id], temp_endpoint->alt_token_pipe);
     }
 
     // Child behavior
     // TODO: FREE UNUSED MEMORY AND RESOURCES
-    // TODO: CLOSE ALL PIPES WITH AUTHORITY/OWNERSHIP!
-    // TODO: Spawn off thread to handle control/admin interaction (pthread_create)
     if(temp_endpoint->pid == 0) {
       // Set child process flag
       child_process_flag = 1;
@@ -114,40 +272,74 @@ int main() {
       // Get child and parent PID
       temp_endpoint->pid = getpid();
 
+      // Shutdown and snapshot signals stay blocked from the fork on and are only taken by the main thread (threads inherit the mask)
+
       // Clean up any and all resources used, but unnecessary for child processes
       // Close unused admin end of admin pipe
       close(temp_endpoint->admin_pipe[PIPE_WRITE_INDEX]);
 
-      // Close wraparound pipe (if able)
-      // If first element
-      if(endpoint_iterator == ENDPOINT_BASE_ADDR) {
-	close(wraparound_fd[PIPE_WRITE_INDEX]);
-      }
-
-      // Else if last element
-      else if(endpoint_iterator >= num_endpoints + ENDPOINT_BASE_ADDR - 1) {
-	close(wraparound_fd[PIPE_READ_INDEX]);
-      }
-
-      // If not first or last
-      else {
-	// Close the wraparound pipe
-	close(wraparound_fd[PIPE_WRITE_INDEX]);
-	close(wraparound_fd[PIPE_READ_INDEX]);
+      // Close the wraparound and carry pipes of every ring that aren't ours
+      for(ring_iterator=0; ring_iterator<num_rings; ring_iterator++) {
+	ring_builder_close_foreign(&rings[ring_iterator], temp_endpoint);
       }
 
       // Close all open admin pipes
       int pipe_iterator;
-      for(pipe_iterator=0; pipe_iterator<num_endpoints; pipe_iterator++) {
-	close(admin_pipes[pipe_iterator]);
+      for(pipe_iterator=0; pipe_iterator<num_processes; pipe_iterator++) {
+	if(admin_pipes[pipe_iterator].fd >= 0) {
+	  close(admin_pipes[pipe_iterator].fd);
+	}
       }
 
       // Free temp_endpoint space
       free(admin_pipes); // Child free [1]
 
+      // Only the admin process reads completions
+      close(completion_pipe[PIPE_READ_INDEX]);
+
+      // Bridges route using the planned ring of every endpoint, including bridges forked after them
+      int *route_table = NULL;
+      int route_table_length = 0;
+
+      if(alt_ring_id >= 0 && !sim_options.dual_ring) {
+	route_table_length = num_processes + ENDPOINT_BASE_ADDR;
+	route_table = plan_route_table(num_processes, num_endpoints, &sim_options);
+      }
+
       // Create threads for the admin and token handlers
-      pthread_create(&admin_thread, NULL, admin_thread_handler, temp_endpoint);
-      pthread_create(&token_thread, NULL, token_ring_passer, temp_endpoint);
+      this_node = node_create(temp_endpoint, &sim_options, ring_sizes, completion_pipe[PIPE_WRITE_INDEX], route_table, route_table_length);
+
+      // Pick up where the snapshot left off
+      if(this_node != NULL && sim_options.restore_path != NULL) {
+	if(node_restore(this_node, &restore_snap) != 0) {
+	  printf("Error: Unable to restore endpoint %d.\n", endpoint_iterator);
+	  exit(1);
+	}
+
+	snapshot_close(&restore_snap);
+      }
+
+      // Slim nodes let go of the admin process's state before starting any threads
+      if(this_node != NULL && sim_options.slim) {
+	endpoint_list_recycle(endpoint_list_head);
+	endpoint_list_head = NULL;
+	free(temp_endpoint);
+	temp_endpoint = NULL;
+	free(rings);
+	rings = NULL;
+	free(ring_sizes);
+	ring_sizes = NULL;
+	fclose(output_file);
+
+	// Every thread would otherwise reserve a malloc arena of its own
+	mallopt(M_ARENA_MAX, 1);
+	malloc_trim(0);
+      }
+
+      if(this_node == NULL || node_start(this_node) != 0) {
+	printf("Error: Unable to start endpoint %d.\n", endpoint_iterator);
+	exit(1);
+      }
 
       // Exit the for loop
       break;
@@ -157,15 +349,21 @@ int main() {
     // TODO: Spawn off thread to handle user interaction (pthread_create)
     else {
       // Add control pipe endpoints to array ([1] assignment)
-      admin_pipes[endpoint_iterator-ENDPOINT_BASE_ADDR] = temp_endpoint->admin_pipe[PIPE_WRITE_INDEX];
+      // The channel owns the write end from here on
+      admin_channel_init(&admin_pipes[endpoint_iterator-ENDPOINT_BASE_ADDR], temp_endpoint->admin_pipe[PIPE_WRITE_INDEX]);
+      temp_endpoint->admin_pipe[PIPE_WRITE_INDEX] = -1;
 
       // Close unused pipes
       // Close read end of admin pipe (only used by child)
       close(temp_endpoint->admin_pipe[PIPE_READ_INDEX]);
+      temp_endpoint->admin_pipe[PIPE_READ_INDEX] = -1;
 
       // Close token pipe (only used by child)
-      /* close(temp_endpoint->token_pipe[PIPE_READ_INDEX]); */
-      /* close(temp_endpoint->token_pipe[PIPE_WRITE_INDEX]); */
+      ring_builder_release(&rings[ring_id], temp_endpoint->token_pipe);
+
+      if(alt_ring_id >= 0) {
+	ring_builder_release(&rings[alt_ring_id], temp_endpoint->alt_token_pipe);
+      }
 
       // Add the endpoint to the list
       endpoint_list_head = endpoint_list_add(endpoint_list_head, temp_endpoint);
@@ -177,17 +375,49 @@ int main() {
 
   // Child process behavior
   if(child_process_flag) {
-    pthread_join(admin_thread, NULL);
-    pthread_join(token_thread, NULL);
+    int signal_number;
+
+    // Wait for the admin process (or ^C) to ask for a shutdown, pausing and snapshotting on the way
+    while(1) {
+      sigwait(&node_signals, &signal_number);
+
+      if(signal_number == SIGUSR1) {
+	node_pause(this_node);
+      }
+      else if(signal_number == SIGUSR2) {
+	node_snapshot(this_node, sim_options.snapshot_path);
+      }
+      else if(signal_number == NODE_RESUME_SIGNAL) {
+	node_resume(this_node);
+      }
+      else if(signal_number == NODE_STATS_SIGNAL) {
+	node_print_stats(this_node);
+	fflush(stdout);
+      }
+      else {
+	break;
+      }
+    }
 
-    printf("Child thread exited...\n");
-    while(1);
+    // Finish (or give up on) the queued messages and report the final counters
+    node_shutdown(this_node, sim_options.drain_deadline_ms);
   }
 
   // Parent process behavior
   else {
     printf("Admin process: %d\n", getpid());
 
+    // Every node is forked, the prompt takes ^C and SIGTERM again
+    pthread_sigmask(SIG_SETMASK, &admin_signals, NULL);
+
+    // Only the nodes write completions, so the reader sees end of file once they have all exited
+    close(completion_pipe[PIPE_WRITE_INDEX]);
+
+    if(admin_completions_start(&completions, completion_pipe[PIPE_READ_INDEX]) != 0) {
+      printf("ERROR: Couldn't start the completion reader.\n");
+      exit(1);
+    }
+
     // Admin variables
     int destination_id, source_id;
 
@@ -195,10 +425,40 @@ int main() {
     // Create a blank message to directly start the token ring
     message *msg = message_create(-1, NULL);
 
-    // Write the first message to the pipeline
-    write(endpoint_list_head->endp->token_pipe[PIPE_WRITE_INDEX], msg, sizeof(message));
+    // Write the first message (every empty slot of a slotted ring) into the wraparound pipe of every ring (a restored ring already has its token)
+    for(ring_iterator=0; ring_iterator<num_rings; ring_iterator++) {
+      for(slot_iterator=0; sim_options.restore_path == NULL && slot_iterator<sim_options.slots; slot_iterator++) {
+	write(rings[ring_iterator].wraparound_fd[PIPE_WRITE_INDEX], msg, sizeof(message));
+      }
+
+      // The last member of the ring now holds the only write end
+      close(rings[ring_iterator].wraparound_fd[PIPE_WRITE_INDEX]);
+      rings[ring_iterator].wraparound_fd[PIPE_WRITE_INDEX] = -1;
+    }
+
+    free(msg);
+
+    if(sim_options.restore_path != NULL) {
+      snapshot_close(&restore_snap);
+    }
+
+    // Take commands from other processes as well as the prompt
+    if(sim_options.control_path != NULL) {
+      if(control_server_start(&control, sim_options.control_path, admin_pipes, num_processes, &completions, sim_options.queue_depth) != 0) {
+	printf("ERROR: Couldn't listen on %s.\n", sim_options.control_path);
+	sim_options.control_path = NULL;
+      }
+      else {
+	printf("Listening for commands on %s.\n", sim_options.control_path);
+      }
+    }
 
     const char *quit_text = "quit";
+    const char *fail_text = "fail";
+    const char *load_text = "load";
+    const char *snapshot_text = "snapshot";
+    const char *profile_text = "profile";
+    const char *memory_text = "memory";
 
     // Allocate space for the message body and header
     char *msg_body = malloc(MESSAGE_MAX_BODY_LENGTH);
@@ -207,31 +467,72 @@ int main() {
 
     // Main admin loop
     while(admin_running) {
+      // Give nodes that have caught up their deferred messages
+      for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+	admin_channel_flush(&admin_pipes[endpoint_iterator]);
+      }
+
       // Get the user's input
       // TODO: Validate user input
       printf("Please enter a node to send a message from: ");
-      fgets(msg_header_from, MESSAGE_MAX_HEADER_LENGTH, stdin);
 
-      // if the user attempted to exit the program using exit keyword
-      if(strncmp(msg_header_from, quit_text, 4) == 0) {
+      // if the user attempted to exit the program using exit keyword, ^C or end of input
+      if(fgets(msg_header_from, MESSAGE_MAX_HEADER_LENGTH, stdin) == NULL || !admin_running ||
+	 strncmp(msg_header_from, quit_text, 4) == 0) {
 	admin_running = 0;
 	break;
       }
 
+      // if the user wants to simulate the failure of a node
+      if(strncmp(msg_header_from, fail_text, 4) == 0) {
+	admin_fail_endpoint(endpoint_list_head, admin_pipes, strtol(msg_header_from + 4, NULL, 10));
+	continue;
+      }
+
+      // if the user wants to save the state of the ring
+      if(strncmp(msg_header_from, snapshot_text, 8) == 0) {
+	admin_snapshot(endpoint_list_head, admin_pipes, num_processes, num_endpoints, num_rings, &completions,
+		       sim_options.control_path != NULL ? &control : NULL);
+	continue;
+      }
+
+      // if the user wants to see where the nodes spend their time
+      if(strncmp(msg_header_from, profile_text, 7) == 0) {
+	admin_request_stats(endpoint_list_head, admin_pipes, num_processes);
+	continue;
+      }
+
+      // if the user wants to know how much memory the nodes use
+      if(strncmp(msg_header_from, memory_text, 6) == 0) {
+	admin_print_memory(endpoint_list_head, admin_pipes, num_processes);
+	continue;
+      }
+
+      // if the user wants to keep a number of messages in flight between random endpoints
+      if(strncmp(msg_header_from, load_text, 4) == 0) {
+	char *load_args;
+	int load_count = strtol(msg_header_from + 4, &load_args, 10);
+	int load_window = strtol(load_args, NULL, 10);
+
+	admin_run_load(admin_pipes, num_processes, &completions, load_count,
+		       load_window > 0 ? load_window : ADMIN_LOAD_WINDOW_DEFAULT);
+	continue;
+      }
+
       printf("Please enter a node to send a message to: ");
-      fgets(msg_header_to, MESSAGE_MAX_HEADER_LENGTH, stdin);
 
-      // if the user attempted to exit the program using exit keyword
-      if(strncmp(msg_header_to, quit_text, 4) == 0) {
+      // if the user attempted to exit the program using exit keyword, ^C or end of input
+      if(fgets(msg_header_to, MESSAGE_MAX_HEADER_LENGTH, stdin) == NULL || !admin_running ||
+	 strncmp(msg_header_to, quit_text, 4) == 0) {
 	admin_running = 0;
 	break;
       }
 
       printf("Please enter a message for the network: ");
-      fgets(msg_body, MESSAGE_MAX_BODY_LENGTH, stdin);
 
-      // if the user attempted to exit the program using exit keyword
-      if(strncmp(msg_body, quit_text, 4) == 0) {
+      // if the user attempted to exit the program using exit keyword, ^C or end of input
+      if(fgets(msg_body, MESSAGE_MAX_BODY_LENGTH, stdin) == NULL || !admin_running ||
+	 strncmp(msg_body, quit_text, 4) == 0) {
 	admin_running = 0;
 	break;
       }
@@ -242,11 +543,37 @@ int main() {
       // Get the source node id from the string provided by the user
       source_id = strtol(msg_header_from, NULL, 10);
 
+      // Only endpoints that exist can send or receive
+      if(source_id < ENDPOINT_BASE_ADDR || source_id >= num_processes + ENDPOINT_BASE_ADDR ||
+	 destination_id < ENDPOINT_BASE_ADDR || destination_id >= num_processes + ENDPOINT_BASE_ADDR) {
+	printf("Endpoints must be between %d and %d.\n", ENDPOINT_BASE_ADDR, num_processes + ENDPOINT_BASE_ADDR - 1);
+	continue;
+      }
+
+      // Failed endpoints can't send anything
+      if(admin_pipes[source_id - ENDPOINT_BASE_ADDR].fd < 0) {
+	printf("Endpoint %d has failed.\n", source_id);
+	continue;
+      }
+
       // Create the message to be sent
       msg = message_create(destination_id, msg_body);
 
-      // Write the message to the admin pipe
-      write(admin_pipes[source_id - 1], msg, sizeof(message));
+      // Write the message to the admin pipe, holding on to it if the node's queue is full
+      admin_completions_sent(&completions);
+
+      switch(admin_channel_send(&admin_pipes[source_id - ENDPOINT_BASE_ADDR], msg, sim_options.queue_depth)) {
+      case ADMIN_SEND_DEFERRED:
+	printf("Endpoint %d is busy, message deferred (%d waiting).\n", source_id, admin_channel_deferred(&admin_pipes[source_id - ENDPOINT_BASE_ADDR]));
+	break;
+
+      case ADMIN_SEND_REJECTED:
+	printf("Endpoint %d is saturated, message rejected.\n", source_id);
+	admin_completions_unsent(&completions);
+	break;
+      }
+
+      free(msg);
     }
 
     /*******************************
@@ -258,14 +585,32 @@ int main() {
     free(msg_header_from);
     free(msg_header_to);
 
+    // No more messages from other processes
+    if(sim_options.control_path != NULL) {
+      control_server_stop(&control);
+    }
+
+    // Let every node drain its queue and exit, then reap them
+    admin_shutdown_endpoints(endpoint_list_head, admin_pipes, num_processes, sim_options.drain_deadline_ms);
+
+    // Report what the nodes delivered
+    admin_completions_stop(&completions);
+
+    // Report how hard the nodes pushed back
+    admin_print_channel_stats(admin_pipes, num_processes);
+
     // Free parent specific pipes
-    for(endpoint_iterator=0; endpoint_iterator<num_endpoints; endpoint_iterator++) {
-      close(admin_pipes[endpoint_iterator]);
+    for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+      admin_channel_close(&admin_pipes[endpoint_iterator]);
     }
 
+    endpoint_list_recycle(endpoint_list_head);
+
     // Free parent specific memory
     // Free admin pipes parent [1]
     free(admin_pipes);
+    free(rings);
+    free(ring_sizes);
   }
 
   // Perform synchronous exit cleanup
@@ -274,117 +619,569 @@ int main() {
   return 0;
 }
 
-// Token passing thread
-void *token_ring_passer(void *endpoint_descriptor) {
-  endpoint *endpoint_description = endpoint_descriptor;
+// Returns the total number of members (endpoints and bridges) in a ring
+static int ring_member_count(int ring_id, int num_endpoints, const simulator_options *opts) {
+  int num_rings = opts->rings;
 
-  // Thread descriptor variables
-  int token_id = endpoint_description->token_id;
-  int token_rd_pipe = endpoint_description->token_pipe[PIPE_READ_INDEX];
-  int token_wr_pipe = endpoint_description->token_pipe[PIPE_WRITE_INDEX];
+  // Both dual rings pass through every endpoint
+  if(opts->dual_ring) {
+    return num_endpoints;
+  }
 
-  // Message variables
-  message *msg_buffer = malloc(sizeof(message));
-  int msg_sent_flag = 0;
-  int msg_dest = 0;
-  int rd_len = 0;
+  // Endpoints are spread evenly, earlier rings take the remainder
+  int count = num_endpoints / num_rings + (ring_id < num_endpoints % num_rings ? 1 : 0);
 
-  while(1) {
-    // Read
-    rd_len = read(token_rd_pipe, msg_buffer, sizeof(message));
+  // Bridges to the previous and next rings in the chain
+  if(ring_id > 0) {
+    count++;
+  }
 
-    // Process
-    // TODO: Handle incomplete reads (not 100% of bytes in first read)
-    printf("\nEndpoint %d (%d) read in %d of %ld bytes\n", token_id, endpoint_description->pid, rd_len, sizeof(message));
+  if(ring_id < num_rings - 1) {
+    count++;
+  }
 
-    // Non-blank message received
-    if(strlen(msg_buffer->header) > 0) {
+  return count;
+}
 
-      // Get message destination from string
-      msg_dest = strtol(msg_buffer->header, NULL, 10);
+// Works out which ring(s) the endpoint created at the supplied index belongs to
+static void plan_endpoint(int index, int num_endpoints, const simulator_options *opts, int *ring_id, int *alt_ring_id) {
+  int num_rings = opts->rings;
+  int ring_iterator;
+  int ring_endpoints;
+
+  // Every endpoint is on both the primary and the secondary ring
+  if(opts->dual_ring) {
+    *ring_id = 0;
+    *alt_ring_id = 1;
+    return;
+  }
 
-      // Handle message reception for this node
-      if(msg_dest == token_id) {
-	printf("Endpoint %d: Received message: %s", token_id, msg_buffer->body);
+  *alt_ring_id = -1;
 
-	// Acknowledge reception of message
-	message_acknowledge(msg_buffer);
-      }
+  // Bridges are created after every ordinary endpoint, one per neighbouring pair of rings
+  if(index >= num_endpoints) {
+    *ring_id = index - num_endpoints;
+    *alt_ring_id = *ring_id + 1;
+    return;
+  }
 
-      // Handle message successfully sent
-      else if(msg_sent_flag) {
-	if(msg_dest == 0) {
-	  printf("Endpoint %d: Message successfully sent and acknowledged.\n", token_id);
+  // Ordinary endpoints fill the rings in order
+  for(ring_iterator=0; ring_iterator<num_rings; ring_iterator++) {
+    ring_endpoints = num_endpoints / num_rings + (ring_iterator < num_endpoints % num_rings ? 1 : 0);
 
-	  // Clear the message sent flag
-	  msg_sent_flag = 0;
+    if(index < ring_endpoints) {
+      break;
+    }
 
-	  // Finalize message
-	  msg_queue = message_complete(msg_buffer, msg_queue);
+    index -= ring_endpoints;
+  }
 
-	  // Fill the message buffer with a new blank message
-	  msg_buffer = message_create(-1, NULL);
-	}
+  *ring_id = ring_iterator;
+}
 
-	// Handle message not acknowledged
-	else {
-	  printf("Endpoint %d: Message failed to be received.\n", token_id);
-	}
-      }
+// Builds a table of the ring every token id will be on, indexed by token id (-1 for ids below ENDPOINT_BASE_ADDR)
+static int *plan_route_table(int num_processes, int num_endpoints, const simulator_options *opts) {
+  int *route_table = malloc((num_processes + ENDPOINT_BASE_ADDR) * sizeof(int));
+  int endpoint_iterator;
+  int alt_ring_id;
 
-      // Not intended destination, nor did this node send anything
-      else {
-	printf("Endpoint %d: Passing token ahead...\n", token_id);
-      }
+  if(route_table == NULL) {
+    return NULL;
+  }
+
+  for(endpoint_iterator=0; endpoint_iterator<ENDPOINT_BASE_ADDR; endpoint_iterator++) {
+    route_table[endpoint_iterator] = -1;
+  }
+
+  // A bridge is reached through the lower of its two rings
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    plan_endpoint(endpoint_iterator, num_endpoints, opts, &route_table[endpoint_iterator + ENDPOINT_BASE_ADDR], &alt_ring_id);
+  }
+
+  return route_table;
+}
+
+// Splices a freshly created token pipe into the ring (run by both parent and child)
+static void ring_builder_attach(ring_builder *rb, int token_pipe[2]) {
+  int new_read_fd = token_pipe[PIPE_READ_INDEX];
+  int new_write_fd = token_pipe[PIPE_WRITE_INDEX];
+
+  // Counter-rotating rings are wired the same way with the direction of every pipe flipped
+  if(rb->reversed) {
+    // The first member writes to the wraparound pipe, the rest write to the previous member
+    if(rb->attached == 0) {
+      token_pipe[PIPE_WRITE_INDEX] = rb->wraparound_fd[PIPE_WRITE_INDEX];
+    }
+    else {
+      token_pipe[PIPE_WRITE_INDEX] = rb->carry_fd;
+    }
+
+    // The last member reads from the wraparound pipe instead of its own
+    if(rb->attached == rb->size - 1) {
+      close(new_read_fd);
+      close(new_write_fd);
+
+      token_pipe[PIPE_READ_INDEX] = rb->wraparound_fd[PIPE_READ_INDEX];
+      rb->carry_fd = -1;
     }
 
-    // Blank message received
+    // Otherwise the next member writes what this one reads
     else {
-      // If a message is available
-      if(msg_queue != NULL) {
-	printf("Endpoint %d: Putting new message on blank token.\n", token_id);
+      rb->carry_fd = new_write_fd;
+    }
+
+    rb->attached++;
+    return;
+  }
 
-	// set the message sent flag
-	msg_sent_flag = 1;
+  // The first member reads from the wraparound pipe, the rest read from the previous member
+  if(rb->attached == 0) {
+    token_pipe[PIPE_READ_INDEX] = rb->wraparound_fd[PIPE_READ_INDEX];
+  }
+  else {
+    token_pipe[PIPE_READ_INDEX] = rb->carry_fd;
+  }
+
+  // The last member writes to the wraparound pipe instead of its own
+  if(rb->attached == rb->size - 1) {
+    close(new_read_fd);
+    close(new_write_fd);
+
+    token_pipe[PIPE_WRITE_INDEX] = rb->wraparound_fd[PIPE_WRITE_INDEX];
+    rb->carry_fd = -1;
+  }
+
+  // Otherwise the next member reads what this one writes
+  else {
+    rb->carry_fd = new_read_fd;
+  }
+
+  rb->attached++;
+}
+
+// Closes the parent's copy of a member's token pipe once the member has been forked
+static void ring_builder_release(ring_builder *rb, int token_pipe[2]) {
+  close(token_pipe[PIPE_READ_INDEX]);
+
+  if(token_pipe[PIPE_READ_INDEX] == rb->wraparound_fd[PIPE_READ_INDEX]) {
+    rb->wraparound_fd[PIPE_READ_INDEX] = -1;
+  }
+
+  // The wraparound write end is kept until the ring has been bootstrapped
+  if(token_pipe[PIPE_WRITE_INDEX] != rb->wraparound_fd[PIPE_WRITE_INDEX]) {
+    close(token_pipe[PIPE_WRITE_INDEX]);
+  }
+
+  token_pipe[PIPE_READ_INDEX] = -1;
+  token_pipe[PIPE_WRITE_INDEX] = -1;
+}
+
+// Returns non-zero if the descriptor is one of the endpoint's token pipe ends
+static int endpoint_owns_fd(endpoint *endp, int fd) {
+  return fd == endp->token_pipe[PIPE_READ_INDEX] || fd == endp->token_pipe[PIPE_WRITE_INDEX] ||
+    fd == endp->alt_token_pipe[PIPE_READ_INDEX] || fd == endp->alt_token_pipe[PIPE_WRITE_INDEX];
+}
+
+// Closes a child's inherited copies of ring pipes that belong to other members
+static void ring_builder_close_foreign(ring_builder *rb, endpoint *endp) {
+  int fds[3] = {rb->wraparound_fd[PIPE_READ_INDEX], rb->wraparound_fd[PIPE_WRITE_INDEX], rb->carry_fd};
+  int fd_iterator;
 
-	// Get rid of the old message
-	free(msg_buffer);
+  for(fd_iterator=0; fd_iterator<3; fd_iterator++) {
+    if(fds[fd_iterator] >= 0 && !endpoint_owns_fd(endp, fds[fd_iterator])) {
+      close(fds[fd_iterator]);
+    }
+  }
+}
+
+// Kills a node process to simulate a station failure
+static void admin_fail_endpoint(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int token_id) {
+  endpoint *failed = endpoint_list_find(endpoint_list_head, token_id);
+
+  if(failed == NULL || admin_pipes[token_id - ENDPOINT_BASE_ADDR].fd < 0) {
+    printf("Endpoint %d is not running.\n", token_id);
+    return;
+  }
+
+  printf("Failing endpoint %d (%d)...\n", token_id, failed->pid);
+
+  kill(failed->pid, SIGKILL);
+  waitpid(failed->pid, NULL, 0);
+
+  // Nothing more can be sent from the failed endpoint
+  admin_channel_close(&admin_pipes[token_id - ENDPOINT_BASE_ADDR]);
+}
+
+// Prints the backpressure counters of every node that pushed back
+static void admin_print_channel_stats(admin_channel *admin_pipes, int num_processes) {
+  int channel_iterator;
+  int abandoned = 0;
+  admin_channel *ch;
+
+  for(channel_iterator=0; channel_iterator<num_processes; channel_iterator++) {
+    ch = &admin_pipes[channel_iterator];
+
+    if(ch->deferrals > 0 || ch->rejected > 0) {
+      printf("Endpoint %d: %lu sent, %lu deferred (high water %d), %lu rejected, %d abandoned.\n",
+	     channel_iterator + ENDPOINT_BASE_ADDR, ch->sent, ch->deferrals, ch->deferred_high_water, ch->rejected, ch->deferred_count);
+    }
+
+    abandoned += ch->deferred_count;
+  }
+
+  if(abandoned > 0) {
+    printf("%d deferred messages were abandoned without reaching their node.\n", abandoned);
+  }
+}
+
+// Sends count messages between random live endpoints, keeping window of them undelivered at a time
+static void admin_run_load(admin_channel *admin_pipes, int num_processes, admin_completions *completions, int count, int window) {
+  unsigned long delivered_before, delivered_after;
+  int64_t latency_before, latency_after;
+  int64_t start_ns, elapsed_ns;
+  int *live = malloc(num_processes * sizeof(int));
+  int live_count = 0;
+  int sent = 0;
+  int outstanding = 0;
+  int endpoint_iterator;
+  int source_id, destination_id;
+  message *msg;
 
-	// Retrieve it from the message queue
-	msg_buffer = message_queue_get_message(msg_queue);
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    if(admin_pipes[endpoint_iterator].fd >= 0) {
+      live[live_count++] = endpoint_iterator + ENDPOINT_BASE_ADDR;
+    }
+  }
+
+  if(count < 1 || live_count < 2) {
+    printf("Usage: load <messages> [outstanding] (needs at least 2 live endpoints)\n");
+    free(live);
+    return;
+  }
+
+  printf("Sending %d messages, %d outstanding...\n", count, window);
+
+  admin_completions_snapshot(completions, &delivered_before, &latency_before);
+  start_ns = message_clock_ns();
+
+  while(admin_running) {
+    // Completions free up room in the node queues as well
+    for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+      admin_channel_flush(&admin_pipes[endpoint_iterator]);
+    }
+
+    outstanding = admin_completions_wait(completions, sent < count ? window : 1, ADMIN_LOAD_STALL_MS);
+
+    if(outstanding < 0) {
+      printf("No deliveries for %d ms, giving up.\n", ADMIN_LOAD_STALL_MS);
+      break;
+    }
+
+    if(sent >= count) {
+      if(outstanding == 0) {
+	break;
       }
+      continue;
+    }
 
-      // Pass the message that was received
-      else {
-	// do nothing.
-	printf("Endpoint %d: Blank token found.\n", token_id);
+    source_id = live[rand() % live_count];
+
+    do {
+      destination_id = live[rand() % live_count];
+    } while(destination_id == source_id);
+
+    msg = message_create(destination_id, "Load generator message\n");
+
+    // A rejected message is retried once a delivery has made room
+    admin_completions_sent(completions);
+
+    if(admin_channel_send(&admin_pipes[source_id - ENDPOINT_BASE_ADDR], msg, sim_options.queue_depth) != ADMIN_SEND_REJECTED) {
+      sent++;
+    }
+    else {
+      admin_completions_unsent(completions);
+
+      if(outstanding > 0 && admin_completions_wait(completions, outstanding, ADMIN_LOAD_STALL_MS) < 0) {
+	printf("No deliveries for %d ms, giving up.\n", ADMIN_LOAD_STALL_MS);
+	free(msg);
+	break;
+      }
+    }
+
+    free(msg);
+  }
+
+  elapsed_ns = message_clock_ns() - start_ns;
+  admin_completions_snapshot(completions, &delivered_after, &latency_after);
+
+  printf("Load: %d sent, %lu delivered in %.3f s (%.1f messages/s)",
+	 sent, delivered_after - delivered_before, elapsed_ns / 1e9, (delivered_after - delivered_before) / (elapsed_ns / 1e9));
+
+  if(delivered_after > delivered_before) {
+    printf(", %.3f ms average latency", (latency_after - latency_before) / 1e6 / (delivered_after - delivered_before));
+  }
+
+  printf(".\n");
+
+  free(live);
+}
+
+// Asks every live node to print its counters and hop profile
+static void admin_request_stats(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes) {
+  endpoint *endp;
+  int endpoint_iterator;
+
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+
+    if(admin_pipes[endpoint_iterator].fd >= 0 && endp != NULL) {
+      kill(endp->pid, NODE_STATS_SIGNAL);
+    }
+  }
+
+  if(PROFILE_ENABLED) {
+    printf("Node counters and hop profiles written to output.txt.\n");
+  }
+  else {
+    printf("Node counters written to output.txt (hop profiles need a build with make profile).\n");
+  }
+}
+
+// Adds up the memory used by every live node
+static void admin_print_memory(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes) {
+  node_memory usage;
+  endpoint *endp;
+  unsigned long rss = 0, pss = 0, virtual_size = 0;
+  int endpoint_iterator;
+  int measured = 0;
+
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+
+    if(admin_pipes[endpoint_iterator].fd < 0 || endp == NULL || node_memory_usage(endp->pid, &usage) != 0) {
+      continue;
+    }
+
+    rss += usage.rss;
+    pss += usage.pss;
+    virtual_size += usage.virtual_size;
+    measured++;
+  }
+
+  if(measured == 0) {
+    printf("No node memory usage available (is /proc/<pid>/smaps_rollup readable?).\n");
+    return;
+  }
+
+  printf("Nodes: %d measured, %lu kB resident (%lu per node), %lu kB proportional share (%lu per node), %lu kB address space per node.\n",
+	 measured, rss, rss / measured, pss, pss / measured, virtual_size / measured);
+
+  if(node_memory_usage(0, &usage) == 0) {
+    printf("Admin process: %lu kB resident, %lu kB proportional share, %lu kB address space.\n", usage.rss, usage.pss, usage.virtual_size);
+  }
+}
+
+// Checks the ring can be snapshotted and takes the snapshot with the control clients held back
+static void admin_snapshot(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int num_endpoints, int num_rings, admin_completions *completions, control_server *control) {
+  int endpoint_iterator;
+
+  if(num_rings > 1) {
+    printf("Only a single ring can be snapshotted.\n");
+    return;
+  }
+
+  // A snapshot holds a single token
+  if(sim_options.slots > 1) {
+    printf("A slotted ring can't be snapshotted.\n");
+    return;
+  }
+
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    if(admin_pipes[endpoint_iterator].fd < 0) {
+      printf("Endpoint %d has failed, the ring can't be snapshotted.\n", endpoint_iterator + ENDPOINT_BASE_ADDR);
+      return;
+    }
+  }
+
+  // Control clients would put messages on the ring behind the snapshot's back
+  if(control != NULL) {
+    control_server_hold(control);
+  }
+
+  admin_snapshot_ring(endpoint_list_head, admin_pipes, num_processes, num_endpoints, completions);
+
+  if(control != NULL) {
+    control_server_release(control);
+  }
+}
+
+// Pauses the ring, has every node save its state and lets the token go again
+static void admin_snapshot_ring(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int num_endpoints, admin_completions *completions) {
+  struct timespec poll_interval = {0, ADMIN_REAP_POLL_NS};
+  snapshot_header header;
+  unsigned long controls;
+  endpoint *endp;
+  int timeout_ms = ADMIN_SNAPSHOT_TIMEOUT_MS + sim_options.hop_delay_us / 1000 * num_processes;
+  int deferred, waited_ms;
+  int endpoint_iterator;
+  int holder, failed;
+
+  // Deferred messages live in the admin process, hand them over first
+  for(waited_ms=0; waited_ms<timeout_ms; waited_ms+=ADMIN_REAP_POLL_NS/1000000) {
+    deferred = 0;
+
+    for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+      deferred += admin_channel_flush(&admin_pipes[endpoint_iterator]);
+    }
+
+    if(deferred == 0) {
+      break;
+    }
+
+    nanosleep(&poll_interval, NULL);
+  }
+
+  if(deferred > 0) {
+    printf("%d deferred messages couldn't be handed over, try again later.\n", deferred);
+    return;
+  }
+
+  // Whoever reads the token next holds on to it
+  pthread_mutex_lock(&completions->lock);
+  controls = completions->controls;
+  completions->control_failures = 0;
+  pthread_mutex_unlock(&completions->lock);
+
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+    kill(endp->pid, SIGUSR1);
+  }
+
+  holder = -1;
+  failed = 0;
+
+  if(admin_completions_wait_controls(completions, ++controls, timeout_ms) == 0) {
+    pthread_mutex_lock(&completions->lock);
+    holder = completions->token_holder;
+    pthread_mutex_unlock(&completions->lock);
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH);
+    header.num_endpoints = num_endpoints;
+    header.node_count = num_processes;
+    header.token_holder = holder;
+    header.next_message_id = message_next_id();
+
+    if(snapshot_write_header(sim_options.snapshot_path, &header) != 0) {
+      printf("Unable to write %s.\n", sim_options.snapshot_path);
+      failed = 1;
+    }
+  }
+  else {
+    printf("The token didn't turn up within %d ms.\n", timeout_ms);
+    failed = 1;
+  }
+
+  // Without a header there is nothing to append to, just let the ring go again (a late holder included)
+  if(failed) {
+    for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+      endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+
+      if(endp != NULL) {
+	kill(endp->pid, NODE_RESUME_SIGNAL);
       }
     }
 
-    // Wait for predefined seconds (allows progress to be tracked by humans)
-    sleep(SIMULATION_SLEEP_TIME);
+    printf("Snapshot failed.\n");
+    unlink(sim_options.snapshot_path);
+    return;
+  }
+
+  // One node at a time appends its section, the token holder goes last and lets the token go
+  for(endpoint_iterator=0; endpoint_iterator<=num_processes; endpoint_iterator++) {
+    if(endpoint_iterator == num_processes) {
+      endp = endpoint_list_find(endpoint_list_head, holder);
+    }
+    else {
+      endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+    }
 
-    // Write
-    write(token_wr_pipe, msg_buffer, sizeof(message));
+    if(endp == NULL || (endpoint_iterator < num_processes && endp->token_id == holder)) {
+      continue;
+    }
+
+    kill(endp->pid, SIGUSR2);
+
+    // Carry on, the holder still has to be told to let the token go
+    if(admin_completions_wait_controls(completions, ++controls, timeout_ms) != 0) {
+      printf("Endpoint %d didn't save its state.\n", endp->token_id);
+      failed = 1;
+    }
+  }
+
+  pthread_mutex_lock(&completions->lock);
+  failed |= completions->control_failures > 0;
+  pthread_mutex_unlock(&completions->lock);
+
+  if(failed) {
+    printf("Snapshot failed.\n");
+    unlink(sim_options.snapshot_path);
+    return;
   }
+
+  printf("Snapshot of %d endpoints written to %s (token held by endpoint %d).\n", num_processes, sim_options.snapshot_path, holder);
+}
+
+// Stops the admin loop on ^C or SIGTERM
+static void admin_signal_handler(int signal_number) {
+  admin_running = 0;
 }
 
-void *admin_thread_handler(void *endpoint_descriptor) {
-  endpoint *endpoint_description = endpoint_descriptor;
+// Asks every live node to drain and exit, reaping them and killing any that overstay the deadline
+static void admin_shutdown_endpoints(endpoint_list *endpoint_list_head, admin_channel *admin_pipes, int num_processes, int deadline_ms) {
+  struct timespec poll_interval = {0, ADMIN_REAP_POLL_NS};
+  long waited_ns = 0;
+  pid_t *pids = malloc(num_processes * sizeof(pid_t));
+  endpoint *endp;
+  int endpoint_iterator;
+  int remaining = 0;
 
-  // Thread descriptor variables
-  int admin_rd_pipe = endpoint_description->admin_pipe[PIPE_READ_INDEX];
+  printf("Shutting down endpoints (deadline %d ms)...\n", deadline_ms);
 
-  // Message variables
-  message *msg_buffer = malloc(sizeof(message));
+  // Failed endpoints have already been reaped
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    endp = endpoint_list_find(endpoint_list_head, endpoint_iterator + ENDPOINT_BASE_ADDR);
+    pids[endpoint_iterator] = -1;
 
-  while(1) {
-    // Read
-    read(admin_rd_pipe, msg_buffer, sizeof(message));
+    if(endp != NULL && admin_pipes[endpoint_iterator].fd >= 0) {
+      pids[endpoint_iterator] = endp->pid;
+      kill(endp->pid, SIGTERM);
+      remaining++;
+    }
+  }
+
+  // Reap the nodes as they finish, allowing a grace period past their own deadline
+  while(remaining > 0 && waited_ns < (deadline_ms + ADMIN_REAP_GRACE_MS) * 1000000L) {
+    for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+      if(pids[endpoint_iterator] > 0 && waitpid(pids[endpoint_iterator], NULL, WNOHANG) == pids[endpoint_iterator]) {
+	pids[endpoint_iterator] = -1;
+	remaining--;
+      }
+    }
 
-    // Process
-    msg_queue = message_queue_put_message(msg_buffer, msg_queue);
+    if(remaining > 0) {
+      nanosleep(&poll_interval, NULL);
+      waited_ns += ADMIN_REAP_POLL_NS;
+    }
+  }
 
-    // Write (if necessary)
+  // Anything still running is stuck
+  for(endpoint_iterator=0; endpoint_iterator<num_processes; endpoint_iterator++) {
+    if(pids[endpoint_iterator] > 0) {
+      printf("Endpoint %d didn't exit in time, killing it.\n", endpoint_iterator + ENDPOINT_BASE_ADDR);
+      kill(pids[endpoint_iterator], SIGKILL);
+      waitpid(pids[endpoint_iterator], NULL, 0);
+    }
   }
+
+  free(pids);
 }
@@ -0,0 +1,184 @@
+/** @file token_wait.c
+ *  @brief Function definitions for the token wait library.
+ *
+ * The token wait library is developed to reduce the
+ * latency of a token hop by busy-polling the token pipe
+ * for a short, adaptive period before yielding the CPU
+ * and finally blocking in the kernel.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "token_wait.h"
+
+// Phases a token can be found in
+#define TOKEN_WAIT_PHASE_SPIN 0
+#define TOKEN_WAIT_PHASE_YIELD 1
+#define TOKEN_WAIT_PHASE_BLOCK 2
+
+// Tell the processor we are in a spin loop
+static inline void token_wait_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static long long token_wait_now_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Attempt a single non-blocking read, returns 1 if the read is finished
+static int token_wait_try_read(token_wait *tw, int fd, void *buf, size_t len, ssize_t *rd_len) {
+  tw->syscalls++;
+  *rd_len = read(fd, buf, len);
+
+  if(*rd_len >= 0) {
+    return 1;
+  }
+
+  // Nothing available yet (or interrupted), keep waiting
+  if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+    return 0;
+  }
+
+  // Real error, let the caller handle it
+  return 1;
+}
+
+int token_wait_init(token_wait *tw, int fd, int spin_max) {
+  int flags;
+
+  tw->spin_max = spin_max;
+  tw->spin_budget = spin_max;
+  tw->avg_gap_ns = 0;
+  tw->spin_hits = 0;
+  tw->yield_hits = 0;
+  tw->block_hits = 0;
+  tw->syscalls = 0;
+
+  // Make the token pipe pollable
+  flags = fcntl(fd, F_GETFL);
+
+  if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+ssize_t token_wait_read(token_wait *tw, int fd, void *buf, size_t len) {
+  long long wait_start = token_wait_now_ns();
+  int phase = TOKEN_WAIT_PHASE_BLOCK;
+  int spin_budget = tw->spin_budget;
+  int iterator;
+  ssize_t rd_len;
+  struct pollfd pfd;
+
+  // Don't bother spinning when the token has recently been slow to arrive
+  if(tw->avg_gap_ns > TOKEN_WAIT_SPIN_CUTOFF_NS) {
+    spin_budget = 0;
+  }
+
+  // Spin phase: busy-poll the pipe
+  if(spin_budget > 0) {
+    for(iterator=0; iterator<spin_budget; iterator++) {
+      if(token_wait_try_read(tw, fd, buf, len, &rd_len)) {
+	phase = TOKEN_WAIT_PHASE_SPIN;
+	goto token_found;
+      }
+
+      token_wait_cpu_relax();
+    }
+
+    // Yield phase: give the processor to the node holding the token
+    for(iterator=0; iterator<TOKEN_WAIT_YIELD_ROUNDS; iterator++) {
+      sched_yield();
+      tw->syscalls++;
+
+      if(token_wait_try_read(tw, fd, buf, len, &rd_len)) {
+	phase = TOKEN_WAIT_PHASE_YIELD;
+	goto token_found;
+      }
+    }
+  }
+
+  // Block phase: sleep in the kernel until the token shows up
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+
+  while(1) {
+    tw->syscalls++;
+
+    if(poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+      return -1;
+    }
+
+    if(token_wait_try_read(tw, fd, buf, len, &rd_len)) {
+      break;
+    }
+  }
+
+ token_found:
+  // Update the moving average of the wait time (1/8 weight for the newest sample)
+  tw->avg_gap_ns += (token_wait_now_ns() - wait_start - tw->avg_gap_ns) / 8;
+
+  // Adapt the spin budget to the phase the token was found in
+  switch(phase) {
+  case TOKEN_WAIT_PHASE_SPIN:
+    tw->spin_hits++;
+    break;
+
+  case TOKEN_WAIT_PHASE_YIELD:
+    // Nearly made it, spin longer next time
+    tw->yield_hits++;
+
+    tw->spin_budget *= 2;
+    if(tw->spin_budget > tw->spin_max) {
+      tw->spin_budget = tw->spin_max;
+    }
+    break;
+
+  default:
+    // Spinning was wasted effort, spin less next time
+    tw->block_hits++;
+
+    if(spin_budget > 0) {
+      tw->spin_budget /= 2;
+      if(tw->spin_budget < TOKEN_WAIT_SPIN_MIN && tw->spin_max >= TOKEN_WAIT_SPIN_MIN) {
+	tw->spin_budget = TOKEN_WAIT_SPIN_MIN;
+      }
+    }
+    break;
+  }
+
+  return rd_len;
+}
+
+void token_wait_print_stats(token_wait *tw, const char *name) {
+  unsigned long total = tw->spin_hits + tw->yield_hits + tw->block_hits;
+
+  printf("%s: Token wait stats: %lu spin (%.1f%%), %lu yield, %lu block, spin budget %d, average wait %lld ns, %.1f system calls per token\n",
+	 name,
+	 tw->spin_hits,
+	 total ? 100.0 * tw->spin_hits / total : 0.0,
+	 tw->yield_hits,
+	 tw->block_hits,
+	 tw->spin_budget,
+	 tw->avg_gap_ns,
+	 total ? (double)tw->syscalls / total : 0.0);
+}
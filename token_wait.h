@@ -0,0 +1,78 @@
+/** @file token_wait.h
+ *  @brief Function prototypes and structure definitions for the token wait library.
+ *
+ * The token wait library is developed to reduce the
+ * latency of a token hop by busy-polling the token pipe
+ * for a short, adaptive period before yielding the CPU
+ * and finally blocking in the kernel.
+ *
+ * A pipe can't be checked for data from user space, so
+ * every spin iteration is a non-blocking read() system
+ * call. The spin trades those calls (counted in syscalls)
+ * for the cost of a scheduler wakeup.
+ *
+ *  @author Joshua Edgcombe (joshedgcombe@gmail.com)
+ *  @bug No known bugs.
+ */
+
+#ifndef __TOKEN_WAIT_H__
+#define __TOKEN_WAIT_H__
+
+#include <sys/types.h>
+
+#define TOKEN_WAIT_SPIN_DEFAULT 4096
+#define TOKEN_WAIT_SPIN_MIN 16
+#define TOKEN_WAIT_YIELD_ROUNDS 16
+
+// Tokens that usually take longer than this to arrive are not worth spinning for
+#define TOKEN_WAIT_SPIN_CUTOFF_NS 200000
+
+// Adaptive wait state for a single token pipe
+typedef struct token_wait {
+  int spin_max;                  // Upper bound for spin_budget
+  int spin_budget;               // Busy-poll iterations before yielding
+  long long avg_gap_ns;          // Moving average of the time spent waiting for the token
+  unsigned long spin_hits;       // Token found while busy-polling (fast path)
+  unsigned long yield_hits;      // Token found while yielding
+  unsigned long block_hits;      // Token found after blocking in the kernel
+  unsigned long syscalls;        // Reads, yields and polls made while waiting
+} token_wait;
+
+/** @brief Prepares a token pipe for adaptive waiting.
+ *
+ *  Initializes the wait state and switches the supplied
+ *  read descriptor to non-blocking mode so it can be polled.
+ *  A spin_max of zero disables the spin and yield phases.
+ *
+ *  @param tw The wait state to be initialized.
+ *  @param fd The token pipe read descriptor.
+ *  @param spin_max The maximum number of busy-poll iterations.
+ *  @return Zero on success, -1 if the descriptor could not be configured.
+ */
+int token_wait_init(token_wait *tw, int fd, int spin_max);
+
+/** @brief Waits for and reads the next token.
+ *
+ *  Busy-polls the pipe for up to spin_budget iterations
+ *  (one non-blocking read each), then yields the processor
+ *  for a few rounds, then blocks
+ *  until data is available. The spin budget is adjusted
+ *  after every token based on the phase it arrived in.
+ *
+ *  @param tw The wait state for the pipe.
+ *  @param fd The token pipe read descriptor.
+ *  @param buf The buffer to read the token into.
+ *  @param len The number of bytes to read.
+ *  @return The result of the successful read call (0 on end of file, -1 on error).
+ */
+ssize_t token_wait_read(token_wait *tw, int fd, void *buf, size_t len);
+
+/** @brief Prints the wait counters to standard output.
+ *
+ *  @param tw The wait state to be printed.
+ *  @param name The name of the endpoint that owns the wait state.
+ *  @return Void.
+ */
+void token_wait_print_stats(token_wait *tw, const char *name);
+
+#endif // __TOKEN_WAIT_H__